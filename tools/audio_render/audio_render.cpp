@@ -0,0 +1,395 @@
+//
+// Title:			Offline audio renderer
+//
+// Runs the VDP's audio code on a PC, so changes to it can be heard and checked without hardware.
+// A script of timed VDU commands drives the channels, samples, envelopes and sequencer through the
+// same vdu_sys_audio code the VDP uses, and the mixed output is written to a WAV file, timed, and
+// optionally compared against a golden file.
+//
+// Usage: audio_render [-r rate] [-o out.wav] [-g golden.wav] [-v] script
+//   -r	sample rate, as the VDP would be set with VDU 23, 0, &85, 255, 13, rate;
+//   -o	write the output to a WAV file
+//   -g	compare the output against a WAV file, and fail on any difference
+//   -v	print debug logging and the status packets sent back for each command
+//
+// Scripts are text, with one instruction per line:
+//   # comment
+//   @ time				render the output up to time, in milliseconds from the start
+//   23, 0, &85, ...	send VDU bytes; a value followed by ; is sent as a 16-bit word, as in BBC BASIC,
+//						and a line ending in a comma carries on to the next
+//   file bufferId name	write a file to a buffer, as VDU 23, 0, &A0, bufferId; 0, length; <data> would
+// Only audio commands (VDU 23, 0, &85) and buffer writes and clears (VDU 23, 0, &A0) are supported.
+//
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static bool verbose = false;
+
+void debug_log(const char * format, ...) {
+	if (verbose) {
+		va_list args;
+		va_start(args, format);
+		vfprintf(stderr, format, args);
+		va_end(args);
+	}
+}
+
+// vdu_audio.h implements its commands as VDUStreamProcessor methods, so this stands in for the
+// VDP's stream processor, which needs the whole of the display code, and reads from the script
+#define VDU_STREAM_PROCESSOR_H
+
+#include "agon.h"
+#include "agon_audio.h"
+#include "buffers.h"
+#include "buffer_stream.h"
+
+class VDUStreamProcessor {
+	public:
+		// Process a line of VDU bytes from the script
+		// Returns false if they contain anything but complete audio and buffer commands
+		bool process(const std::vector<uint8_t> & bytes) {
+			input = bytes;
+			position = 0;
+			while (position < input.size()) {
+				if (readByte_t() != 23 || readByte_t() != 0) {
+					return false;
+				}
+				switch (readByte_t()) {
+					case VDP_AUDIO:
+						vdu_sys_audio();
+						break;
+					case VDP_BUFFERED:
+						if (!vdu_sys_buffered()) {
+							return false;
+						}
+						break;
+					default:
+						return false;
+				}
+			}
+			return true;
+		}
+
+	private:
+		std::vector<uint8_t> input;
+		size_t position = 0;
+
+		int16_t readByte_t(uint16_t timeout = COMMS_TIMEOUT) {
+			return position < input.size() ? input[position++] : -1;
+		}
+
+		int32_t readWord_t(uint16_t timeout = COMMS_TIMEOUT) {
+			auto l = readByte_t();
+			if (l != -1) {
+				auto h = readByte_t();
+				if (h != -1) {
+					return (h << 8) | l;
+				}
+			}
+			return -1;
+		}
+
+		int32_t read24_t(uint16_t timeout = COMMS_TIMEOUT) {
+			auto l = readWord_t();
+			if (l != -1) {
+				auto h = readByte_t();
+				if (h != -1) {
+					return (h << 16) | l;
+				}
+			}
+			return -1;
+		}
+
+		void send_packet(uint8_t code, uint16_t len, uint8_t data[]) {
+			if (verbose) {
+				fprintf(stderr, "packet %d:", code);
+				for (int i = 0; i < len; i++) {
+					fprintf(stderr, " %d", data[i]);
+				}
+				fprintf(stderr, "\n");
+			}
+		}
+
+		// VDU 23, 0, &A0, bufferId; 0, length; <data> and VDU 23, 0, &A0, bufferId; 2
+		bool vdu_sys_buffered() {
+			auto bufferId = readWord_t();	if (bufferId == -1) return false;
+			auto command = readByte_t();	if (command == -1) return false;
+			switch (command) {
+				case BUFFERED_WRITE: {
+					auto length = readWord_t();	if (length == -1) return false;
+					return bufferWrite(bufferId, length) == 0;
+				}
+				case BUFFERED_CLEAR:
+					bufferClear(bufferId);
+					return true;
+			}
+			return false;
+		}
+
+		// As the VDP's, less the bitmaps and fonts that may use buffers
+		uint32_t bufferWrite(uint16_t bufferId, uint32_t length) {
+			if (input.size() - position < length) {
+				return length - (input.size() - position);
+			}
+			auto bufferStream = make_shared_psram<BufferStream>(length);
+			memcpy(bufferStream->getBuffer(), &input[position], length);
+			position += length;
+			if (bufferId == 65535 || appendToSampleStream(bufferId, bufferStream)) {
+				return 0;
+			}
+			buffers[bufferId].push_back(std::move(bufferStream));
+			return 0;
+		}
+
+		void bufferClear(uint16_t bufferId) {
+			if (bufferId == 65535) {
+				buffers.clear();
+				resetSamples();
+				return;
+			}
+			buffers.erase(bufferId);
+		}
+
+		void vdu_sys_audio();
+		void sendAudioStatus(uint8_t channel, uint8_t status);
+		uint8_t loadSample(uint16_t bufferId, uint32_t length);
+		uint8_t createSampleFromBuffer(uint16_t bufferId, uint8_t format, uint16_t sampleRate, bool stream = false);
+		uint8_t setVolumeEnvelope(uint8_t channel, uint8_t type);
+		uint8_t setFrequencyEnvelope(uint8_t channel, uint8_t type);
+		uint8_t setSampleFrequency(uint16_t bufferId, uint16_t frequency);
+		uint8_t setSampleRepeatStart(uint16_t bufferId, uint32_t offset);
+		uint8_t setSampleRepeatLength(uint16_t bufferId, uint32_t length);
+		uint8_t loadSequence(uint8_t channel, uint16_t bufferId);
+		uint8_t setParameter(uint8_t channel, uint8_t parameter, uint16_t value);
+};
+
+#include "vdu_audio.h"
+
+// Parse a number in the script, which may be hex with a leading &
+static bool parseNumber(const std::string & text, long & value) {
+	char * end;
+	if (!text.empty() && text[0] == '&') {
+		value = strtol(text.c_str() + 1, &end, 16);
+		return text.size() > 1 && *end == 0;
+	}
+	value = strtol(text.c_str(), &end, 10);
+	return !text.empty() && *end == 0;
+}
+
+static std::string trim(const std::string & text) {
+	auto start = text.find_first_not_of(" \t\r");
+	if (start == std::string::npos) {
+		return "";
+	}
+	return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+}
+
+// Parse a line of VDU bytes, separated by commas, with ; after a value to send it as a word
+static bool parseBytes(const std::string & line, std::vector<uint8_t> & bytes) {
+	std::string item;
+	auto flush = [&](bool word) {
+		item = trim(item);
+		long value;
+		if (item.empty() && !word) {
+			return true;
+		}
+		if (!parseNumber(item, value)) {
+			return false;
+		}
+		bytes.push_back(value & 0xFF);
+		if (word) {
+			bytes.push_back((value >> 8) & 0xFF);
+		}
+		item.clear();
+		return true;
+	};
+	for (auto c : line) {
+		if (c == ',' || c == ';') {
+			if (!flush(c == ';')) {
+				return false;
+			}
+		} else {
+			item += c;
+		}
+	}
+	return flush(false);
+}
+
+// Write 8-bit signed samples as an 8-bit mono WAV file, which is unsigned
+static bool writeWav(const std::string & path, const std::vector<int8_t> & output, uint32_t sampleRate) {
+	std::ofstream file(path, std::ios::binary);
+	if (!file) {
+		return false;
+	}
+	auto write32 = [&](uint32_t value) { for (int i = 0; i < 4; i++) file.put((value >> (i * 8)) & 0xFF); };
+	auto write16 = [&](uint16_t value) { file.put(value & 0xFF); file.put(value >> 8); };
+	uint32_t size = output.size();
+	file.write("RIFF", 4);
+	write32(36 + size);
+	file.write("WAVEfmt ", 8);
+	write32(16);
+	write16(1);				// PCM
+	write16(1);				// mono
+	write32(sampleRate);
+	write32(sampleRate);	// bytes per second
+	write16(1);				// bytes per frame
+	write16(8);				// bits per sample
+	file.write("data", 4);
+	write32(size);
+	for (auto sample : output) {
+		file.put((uint8_t)(sample + 128));
+	}
+	return (bool)file;
+}
+
+// Read the samples from an 8-bit mono WAV file, as written by writeWav
+static bool readWav(const std::string & path, std::vector<int8_t> & output, uint32_t & sampleRate) {
+	std::ifstream file(path, std::ios::binary);
+	std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if (data.size() < 44 || memcmp(&data[0], "RIFF", 4) || memcmp(&data[8], "WAVEfmt ", 8) || data[34] != 8 || memcmp(&data[36], "data", 4)) {
+		return false;
+	}
+	sampleRate = data[24] | (data[25] << 8) | (data[26] << 16) | (data[27] << 24);
+	output.clear();
+	for (size_t i = 44; i < data.size(); i++) {
+		output.push_back((int8_t)(data[i] - 128));
+	}
+	return true;
+}
+
+int main(int argc, char * argv[]) {
+	uint32_t sampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
+	std::string scriptPath, outputPath, goldenPath;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "-r" && i + 1 < argc) {
+			sampleRate = atoi(argv[++i]);
+		} else if (arg == "-o" && i + 1 < argc) {
+			outputPath = argv[++i];
+		} else if (arg == "-g" && i + 1 < argc) {
+			goldenPath = argv[++i];
+		} else if (arg == "-v") {
+			verbose = true;
+		} else if (scriptPath.empty() && arg[0] != '-') {
+			scriptPath = arg;
+		} else {
+			scriptPath.clear();
+			break;
+		}
+	}
+	if (scriptPath.empty() || sampleRate == 0 || sampleRate > 65535) {
+		fprintf(stderr, "usage: %s [-r rate] [-o out.wav] [-g golden.wav] [-v] script\n", argv[0]);
+		return 2;
+	}
+	std::ifstream script(scriptPath);
+	if (!script) {
+		fprintf(stderr, "%s: can't open script\n", scriptPath.c_str());
+		return 2;
+	}
+	auto scriptDir = scriptPath.substr(0, scriptPath.find_last_of('/') + 1);
+
+	// the stand-in sound generator passes the rate to the mixer when it's attached, as fabgl's does
+	initAudio();
+	setSampleRate(sampleRate);
+
+	VDUStreamProcessor processor;
+	std::vector<int8_t> output;
+	std::chrono::steady_clock::duration renderTime {};
+	std::string line, text;
+	int lineNumber = 0;
+	while (std::getline(script, text)) {
+		lineNumber++;
+		line += trim(text.substr(0, text.find('#')));
+		if (line.empty() || line.back() == ',') {
+			continue;
+		}
+		std::vector<uint8_t> bytes;
+		if (line[0] == '@') {
+			long time;
+			if (!parseNumber(trim(line.substr(1)), time) || time < 0) {
+				fprintf(stderr, "%s:%d: bad time\n", scriptPath.c_str(), lineNumber);
+				return 2;
+			}
+			size_t end = (uint64_t)time * sampleRate / 1000;
+			if (end > output.size()) {
+				auto start = output.size();
+				output.resize(end);
+				auto begin = std::chrono::steady_clock::now();
+				audioMixer.render(&output[start], end - start);
+				renderTime += std::chrono::steady_clock::now() - begin;
+			}
+			line.clear();
+			continue;
+		}
+		if (line.compare(0, 5, "file ") == 0) {
+			std::istringstream args(line.substr(5));
+			std::string id, name;
+			long bufferId;
+			args >> id >> name;
+			std::ifstream file(scriptDir + name, std::ios::binary);
+			if (!parseNumber(id, bufferId) || !file) {
+				fprintf(stderr, "%s:%d: bad buffer or can't open file\n", scriptPath.c_str(), lineNumber);
+				return 2;
+			}
+			std::vector<uint8_t> data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			// buffer writes are at most 65535 bytes, so larger files take several blocks
+			for (size_t offset = 0; offset < data.size(); offset += 65535) {
+				uint16_t length = std::min(data.size() - offset, (size_t)65535);
+				uint8_t header[] = { 23, 0, VDP_BUFFERED, (uint8_t)bufferId, (uint8_t)(bufferId >> 8), BUFFERED_WRITE, (uint8_t)length, (uint8_t)(length >> 8) };
+				bytes.insert(bytes.end(), header, header + sizeof header);
+				bytes.insert(bytes.end(), data.begin() + offset, data.begin() + offset + length);
+			}
+		} else if (!parseBytes(line, bytes)) {
+			fprintf(stderr, "%s:%d: bad VDU bytes\n", scriptPath.c_str(), lineNumber);
+			return 2;
+		}
+		if (!processor.process(bytes)) {
+			fprintf(stderr, "%s:%d: incomplete or unsupported VDU command\n", scriptPath.c_str(), lineNumber);
+			return 2;
+		}
+		line.clear();
+	}
+
+	// apply the master volume, as fabgl's sound generator does
+	for (auto & sample : output) {
+		sample = sample * soundGenerator->volume() / 127;
+	}
+
+	auto seconds = (double)output.size() / sampleRate;
+	auto renderSeconds = std::chrono::duration<double>(renderTime).count();
+	printf("%s: %.3f s of audio at %d Hz rendered in %.3f ms, %.0f ns per second of audio (%.0fx real time)\n",
+		scriptPath.c_str(), seconds, sampleRate, renderSeconds * 1000,
+		seconds > 0 ? renderSeconds * 1e9 / seconds : 0.0, renderSeconds > 0 ? seconds / renderSeconds : 0.0);
+
+	if (!outputPath.empty() && !writeWav(outputPath, output, sampleRate)) {
+		fprintf(stderr, "%s: can't write output\n", outputPath.c_str());
+		return 2;
+	}
+
+	if (!goldenPath.empty()) {
+		std::vector<int8_t> golden;
+		uint32_t goldenRate;
+		if (!readWav(goldenPath, golden, goldenRate)) {
+			fprintf(stderr, "%s: can't read golden file\n", goldenPath.c_str());
+			return 2;
+		}
+		if (goldenRate != sampleRate || golden.size() != output.size()) {
+			printf("FAIL: %s has %zu samples at %d Hz, but rendered %zu at %d Hz\n", goldenPath.c_str(), golden.size(), goldenRate, output.size(), sampleRate);
+			return 1;
+		}
+		for (size_t i = 0; i < output.size(); i++) {
+			if (golden[i] != output[i]) {
+				printf("FAIL: differs from %s at sample %zu (%.3f s): %d, expected %d\n", goldenPath.c_str(), i, (double)i / sampleRate, output[i], golden[i]);
+				return 1;
+			}
+		}
+		printf("PASS: matches %s\n", goldenPath.c_str());
+	}
+	return 0;
+}
@@ -0,0 +1,38 @@
+//
+// Title:			Host stand-in for the Arduino and ESP-IDF calls the audio code uses
+//
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <chrono>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define IRAM_ATTR
+#define MALLOC_CAP_8BIT		0
+#define MALLOC_CAP_SPIRAM	0
+#define pdPASS				1
+
+typedef int BaseType_t;
+
+void debug_log(const char * format, ...);
+
+inline size_t heap_caps_get_free_size(int caps) { return 0; }
+inline void * heap_caps_malloc(size_t size, int caps) { return malloc(size); }
+inline bool psramInit() { return false; }
+inline void * ps_malloc(size_t size) { return malloc(size); }
+inline void vTaskDelay(int ticks) {}
+
+inline unsigned long millis() {
+	static auto start = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+	return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,21 @@
+//
+// Title:			Host stand-in for Arduino's Stream
+//
+
+#ifndef HOST_STREAM_H
+#define HOST_STREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+class Stream {
+	public:
+		virtual ~Stream() {}
+		virtual int available() = 0;
+		virtual int read() = 0;
+		virtual int peek() = 0;
+		virtual size_t write(uint8_t c) = 0;
+		virtual void flush() {}
+};
+
+#endif // HOST_STREAM_H
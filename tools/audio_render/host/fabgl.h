@@ -0,0 +1,88 @@
+//
+// Title:			Host stand-in for fabgl's sound classes
+//
+// Just enough of fabgl for the audio code to build and run on a PC, for the offline renderer.
+// SoundGenerator doesn't play anything: it hands its sample rate to the generator attached to it,
+// as fabgl's does, and the renderer pulls samples from the mixer itself.
+//
+
+#ifndef HOST_FABGL_H
+#define HOST_FABGL_H
+
+#include <stdint.h>
+
+class WaveformGenerator {
+	public:
+		WaveformGenerator() : m_sampleRate(0), m_volume(100), m_enabled(false), m_duration(-1) {}
+		virtual ~WaveformGenerator() {}
+
+		virtual void setFrequency(int value) = 0;
+		virtual int getSample() = 0;
+
+		virtual void setSampleRate(int value) { m_sampleRate = value; }
+		int sampleRate() { return m_sampleRate; }
+
+		void setVolume(int value) { m_volume = value; }
+		int volume() { return m_volume; }
+
+		void enable(bool value) { m_enabled = value; }
+		bool enabled() { return m_enabled; }
+
+		void setDuration(uint32_t value) { m_duration = value; }
+		uint32_t duration() { return m_duration; }
+
+	private:
+		int			m_sampleRate;
+		int			m_volume;
+		bool		m_enabled;
+		uint32_t	m_duration;
+};
+
+// Not fabgl's algorithm, so VIC noise won't match the hardware, but it is repeatable
+class VICNoiseGenerator : public WaveformGenerator {
+	public:
+		void setFrequency(int value) { m_frequency = value; }
+		int getSample() {
+			if (m_frequency == 0 || sampleRate() == 0) {
+				return 0;
+			}
+			m_counter += m_frequency;
+			while (m_counter >= (uint32_t)sampleRate()) {
+				m_counter -= sampleRate();
+				m_lfsr = (m_lfsr >> 1) ^ (-(m_lfsr & 1) & 0xB400u);
+			}
+			int sample = (m_lfsr & 1) ? 127 : -128;
+			return sample * volume() / 127;
+		}
+	private:
+		int			m_frequency = 0;
+		uint32_t	m_counter = 0;
+		uint16_t	m_lfsr = 0xACE1;
+};
+
+namespace fabgl {
+
+class SoundGenerator {
+	public:
+		SoundGenerator(int sampleRate) : m_sampleRate(sampleRate) {}
+
+		void attach(WaveformGenerator * generator) {
+			generator->setSampleRate(m_sampleRate);
+			m_generator = generator;
+		}
+		void clear() { m_generator = nullptr; }
+		bool play(bool value) { return true; }
+
+		void setVolume(int value) { m_volume = value; }
+		int volume() { return m_volume; }
+		int sampleRate() { return m_sampleRate; }
+
+	private:
+		WaveformGenerator *	m_generator = nullptr;
+		int					m_sampleRate;
+		int					m_volume = 127;
+};
+
+} // namespace fabgl
+
+#endif // HOST_FABGL_H
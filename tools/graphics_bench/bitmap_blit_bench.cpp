@@ -0,0 +1,144 @@
+//
+// Title:			Direct bitmap blit benchmark
+//
+// Draws opaque, colour-keyed and alpha RGBA8888 bitmaps into a stand-in framebuffer in each
+// colour depth, with the VDP's direct blit (as used with TEST_FLAG_DIRECT_BLIT set), and with
+// a per-pixel reference that converts and writes every pixel the way a canvas draw does.
+// Each blit is checked against the reference, and the time per draw of each is reported.
+//
+// Bitmaps are 64x64, drawn at a byte-aligned position (x = 64) and an unaligned one (x = 67).
+// Alpha bitmaps can't be blitted, so are always left to fabgl.
+//
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+void debug_log(const char * format, ...) {
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+// the blit code needs only a little of the screen and mouse code, so these stand in for it
+// rather than bringing in the whole of the display code
+#define AGON_PS2_H
+#define AGON_SCREEN_H
+
+#include <fabgl.h>
+#include <memory>
+
+#include "agon.h"
+#include "agon_palette.h"
+
+std::unique_ptr<fabgl::VGABaseController>	_VGAController;
+uint8_t			_VGAColourDepth = 0;
+uint8_t			palette[64];
+uint16_t		canvasW = 640;
+uint16_t		canvasH = 480;
+uint16_t		nativeColourVersion = 0;
+
+inline uint8_t getVGAColourDepth() { return _VGAColourDepth; }
+inline void waitPlotCompletion(bool waitForVSync = false) {}
+uint8_t getPaletteIndex(RGB888 colour) { return 0; }
+
+#include "bitmap_blit.h"
+
+static const int bitmapSize = 64;
+static const int y = 64;
+
+enum class Kind { Opaque, ColourKey, Alpha };
+
+std::vector<uint8_t> makeBitmap(Kind kind, std::mt19937 &random) {
+	std::vector<uint8_t> data(bitmapSize * bitmapSize * 4);
+	for (int i = 0; i < bitmapSize * bitmapSize; i++) {
+		data[i * 4] = random();
+		data[i * 4 + 1] = random();
+		data[i * 4 + 2] = random();
+		auto r = random() % 4;
+		data[i * 4 + 3] = kind == Kind::Opaque || r ? 0xFF : kind == Kind::ColourKey ? 0 : 0x80;
+	}
+	return data;
+}
+
+// Draw a bitmap a pixel at a time, converting each one to the native format
+//
+void drawReference(const Bitmap * bitmap, int x, const uint8_t lut[64], uint8_t depth) {
+	for (int sy = 0; sy < bitmap->height; sy++) {
+		auto row = getFramebufferRow(y + sy);
+		for (int sx = 0; sx < bitmap->width; sx++) {
+			auto source = &bitmap->data[(sy * bitmap->width + sx) * 4];
+			if (source[3] == 0) {
+				continue;
+			}
+			setNativePixel(row, x + sx, depth, lut[(source[0] >> 6) | ((source[1] >> 6) << 2) | ((source[2] >> 6) << 4)]);
+		}
+	}
+}
+
+template<typename Draw>
+double timeDraws(Draw draw) {
+	int draws = 0;
+	auto begin = std::chrono::steady_clock::now();
+	do {
+		for (int i = 0; i < 100; i++) {
+			draw();
+		}
+		draws += 100;
+	} while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(50));
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() * 1e9 / draws;
+}
+
+int main() {
+	const struct { uint8_t depth; const uint8_t * palette; } modes[] = {
+		{ 2, defaultPalette02 }, { 4, defaultPalette04 }, { 8, defaultPalette08 }, { 16, defaultPalette10 }, { 64, defaultPalette40 },
+	};
+	const char * kindNames[] = { "opaque", "colour-key", "alpha" };
+	std::mt19937 random(42);
+	bool failed = false;
+
+	printf("colours  class       x   reference ns/draw   blit ns/draw   speedup\n");
+	for (auto &mode : modes) {
+		_VGAColourDepth = mode.depth;
+		memcpy(palette, mode.palette, mode.depth);
+		nativeColourVersion++;
+		int rowBytes = mode.depth == 2 ? canvasW / 8 : mode.depth == 4 ? canvasW / 4 : mode.depth == 8 ? canvasW * 3 / 8
+			: mode.depth == 16 ? canvasW / 2 : canvasW;
+		_VGAController = std::make_unique<fabgl::VGABaseController>(canvasW, canvasH, rowBytes);
+		uint8_t lut[64];
+		buildNativeColourLUT(lut);
+		Rect clip(0, 0, canvasW - 1, canvasH - 1);
+
+		for (int kind = 0; kind < 3; kind++) {
+			auto data = makeBitmap((Kind)kind, random);
+			auto bitmap = std::make_shared<Bitmap>(bitmapSize, bitmapSize, data.data(), PixelFormat::RGBA8888);
+			for (int x : { 64, 67 }) {
+				// start both from the same noisy screen, then compare
+				auto screen = _VGAController->screen();
+				for (size_t i = 0; i < _VGAController->screenSize(); i++) {
+					screen[i] = random();
+				}
+				std::vector<uint8_t> background(screen, screen + _VGAController->screenSize());
+				drawReference(bitmap.get(), x, lut, mode.depth);
+				std::vector<uint8_t> expected(screen, screen + _VGAController->screenSize());
+				memcpy(screen, background.data(), background.size());
+				bool blitted = blitBitmap(kind, bitmap, x, y, clip);
+				bool match = !blitted || memcmp(screen, expected.data(), expected.size()) == 0;
+				failed |= !match;
+
+				auto reference = timeDraws([&]() { drawReference(bitmap.get(), x, lut, mode.depth); });
+				if (blitted) {
+					auto blit = timeDraws([&]() { blitBitmap(kind, bitmap, x, y, clip); });
+					printf("%7d  %-10s %2d   %17.0f   %12.0f   %6.1fx  %s\n", mode.depth, kindNames[kind], x,
+						reference, blit, reference / blit, match ? "ok" : "MISMATCH");
+				} else {
+					printf("%7d  %-10s %2d   %17.0f   %12s\n", mode.depth, kindNames[kind], x, reference, "(fabgl)");
+				}
+			}
+		}
+	}
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,184 @@
+//
+// Title:			Flood fill benchmark
+//
+// Fills pathological shapes with the VDP's span-stack flood fill, checks each result against a
+// simple queue-based fill, and reports the time taken per filled pixel.
+//
+// Shapes are drawn into a 640x480 byte-per-pixel stand-in for the framebuffer, where 0 is
+// background (fillable) and 1 is a wall:
+//   open		an empty screen
+//   spiral		a square spiral with a two pixel corridor
+//   maze		a randomly generated perfect maze with two pixel corridors
+//   comb		open rows every eight pixels, joined by single pixel teeth, so every row has
+//				hundreds of runs, the seed stack overflows again and again, and dropped seeds
+//				have to be recovered by rescanning
+//
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+void debug_log(const char * format, ...) {
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+#include "flood_fill.h"
+
+static const int width = 640;
+static const int height = 480;
+
+struct Shape {
+	std::string				name;
+	std::vector<uint8_t>	walls;
+	int						seedX;
+	int						seedY;
+};
+
+Shape makeOpen() {
+	return { "open", std::vector<uint8_t>(width * height, 0), width / 2, height / 2 };
+}
+
+Shape makeSpiral() {
+	Shape shape { "spiral", std::vector<uint8_t>(width * height, 0), 0, 0 };
+	// walls every third pixel, turning inwards
+	int x1 = 0, y1 = 0, x2 = width - 1, y2 = height - 1;
+	auto wall = [&shape](int x, int y) { shape.walls[y * width + x] = 1; };
+	for (int x = x1; x <= x2; x++) {
+		wall(x, y1);
+	}
+	y1 += 3;
+	while (x1 + 3 <= x2 && y1 + 3 <= y2) {
+		for (int y = y1; y <= y2; y++) wall(x2, y);
+		x2 -= 3;
+		for (int x = x2; x <= x2 + 3; x++) wall(x, y2);
+		for (int x = x1; x <= x2; x++) wall(x, y2);
+		y2 -= 3;
+		for (int y = y1; y <= y2; y++) wall(x1, y);
+		x1 += 3;
+		for (int x = x1; x <= x2; x++) wall(x, y1);
+		y1 += 3;
+	}
+	shape.seedX = 1;
+	shape.seedY = 1;
+	return shape;
+}
+
+Shape makeMaze() {
+	// cells are three pixels apart, with a one pixel wall between them
+	const int cellsX = (width - 1) / 3;
+	const int cellsY = (height - 1) / 3;
+	Shape shape { "maze", std::vector<uint8_t>(width * height, 1), 1, 1 };
+	auto clear = [&shape](int x, int y) { shape.walls[y * width + x] = 0; };
+	std::vector<bool> visited(cellsX * cellsY, false);
+	std::vector<std::pair<int, int>> stack { { 0, 0 } };
+	std::mt19937 random(1234);
+	visited[0] = true;
+	while (!stack.empty()) {
+		auto [cx, cy] = stack.back();
+		for (int y = 0; y < 2; y++) {
+			for (int x = 0; x < 2; x++) {
+				clear(cx * 3 + 1 + x, cy * 3 + 1 + y);
+			}
+		}
+		std::pair<int, int> options[4];
+		int count = 0;
+		const int dx[] = { 1, -1, 0, 0 };
+		const int dy[] = { 0, 0, 1, -1 };
+		for (int d = 0; d < 4; d++) {
+			int nx = cx + dx[d], ny = cy + dy[d];
+			if (nx >= 0 && nx < cellsX && ny >= 0 && ny < cellsY && !visited[ny * cellsX + nx]) {
+				options[count++] = { dx[d], dy[d] };
+			}
+		}
+		if (count == 0) {
+			stack.pop_back();
+			continue;
+		}
+		auto [mx, my] = options[random() % count];
+		// knock through the wall between the cells
+		for (int i = 0; i < 2; i++) {
+			if (mx) {
+				clear(cx * 3 + 1 + (mx > 0 ? 2 : -1), cy * 3 + 1 + i);
+			} else {
+				clear(cx * 3 + 1 + i, cy * 3 + 1 + (my > 0 ? 2 : -1));
+			}
+		}
+		visited[(cy + my) * cellsX + cx + mx] = true;
+		stack.push_back({ cx + mx, cy + my });
+	}
+	return shape;
+}
+
+Shape makeComb() {
+	Shape shape { "comb", std::vector<uint8_t>(width * height, 0), 0, 0 };
+	for (int y = 0; y < height; y++) {
+		for (int x = 1; x < width; x += 2) {
+			if (y % 8 != 0) {
+				shape.walls[y * width + x] = 1;
+			}
+		}
+	}
+	return shape;
+}
+
+// Reference fill, one pixel at a time from a queue
+//
+std::vector<uint8_t> referenceFill(const Shape &shape) {
+	std::vector<uint8_t> filled(width * height, 0);
+	std::vector<std::pair<int, int>> queue { { shape.seedX, shape.seedY } };
+	filled[shape.seedY * width + shape.seedX] = 1;
+	for (size_t i = 0; i < queue.size(); i++) {
+		auto [x, y] = queue[i];
+		const int dx[] = { 1, -1, 0, 0 };
+		const int dy[] = { 0, 0, 1, -1 };
+		for (int d = 0; d < 4; d++) {
+			int nx = x + dx[d], ny = y + dy[d];
+			if (nx >= 0 && nx < width && ny >= 0 && ny < height && !shape.walls[ny * width + nx] && !filled[ny * width + nx]) {
+				filled[ny * width + nx] = 1;
+				queue.push_back({ nx, ny });
+			}
+		}
+	}
+	return filled;
+}
+
+int main() {
+	Shape shapes[] = { makeOpen(), makeSpiral(), makeMaze(), makeComb() };
+	bool failed = false;
+	for (auto &shape : shapes) {
+		auto expected = referenceFill(shape);
+		std::vector<uint8_t> filled;
+		int runs = 0;
+		int spans = 0;
+		auto begin = std::chrono::steady_clock::now();
+		do {
+			filled.assign(width * height, 0);
+			spans = 0;
+			auto floodFill = std::make_unique<FloodFill>(0, 0, width - 1, height - 1);
+			floodFill->fill(shape.seedX, shape.seedY,
+				[&shape](int16_t x, int16_t y) { return shape.walls[y * width + x] == 0; },
+				[&filled, &spans](int16_t x1, int16_t x2, int16_t y) {
+					memset(&filled[y * width + x1], 1, x2 - x1 + 1);
+					spans++;
+				});
+			runs++;
+		} while (std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(200));
+		auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count() / runs;
+
+		uint32_t pixels = 0;
+		for (auto f : expected) {
+			pixels += f;
+		}
+		bool match = filled == expected;
+		failed |= !match;
+		printf("%-8s %7u pixels in %6d spans: %8.1f us per fill, %5.1f ns per pixel  %s\n",
+			shape.name.c_str(), pixels, spans, seconds * 1e6, seconds * 1e9 / pixels, match ? "ok" : "MISMATCH");
+	}
+	return failed ? 1 : 0;
+}
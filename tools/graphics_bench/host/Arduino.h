@@ -0,0 +1,18 @@
+//
+// Title:			Host stand-in for the Arduino and ESP-IDF calls the graphics code uses
+//
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+void debug_log(const char * format, ...);
+
+inline bool psramInit() { return false; }
+inline void * ps_malloc(size_t size) { return malloc(size); }
+
+#endif // HOST_ARDUINO_H
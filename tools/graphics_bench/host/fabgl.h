@@ -0,0 +1,233 @@
+//
+// Title:			Host stand-in for fabgl's graphics classes
+//
+// Just enough of fabgl for the VDP's graphics code to build and run on a PC, for the benchmarks.
+// VGABaseController holds a framebuffer, with row pointers in m_viewPort as fabgl's does.
+// It composites sprites into it, treating it as a byte per pixel, the way fabgl's refresh does:
+// restoring saved backgrounds in reverse order, then saving and drawing each sprite.  It counts
+// the pixels it touches.
+//
+
+#ifndef HOST_FABGL_H
+#define HOST_FABGL_H
+
+#include <algorithm>
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+namespace fabgl {
+
+struct RGB888 {
+	uint8_t		R;
+	uint8_t		G;
+	uint8_t		B;
+
+	RGB888() : R(0), G(0), B(0) {}
+	RGB888(uint8_t red, uint8_t green, uint8_t blue) : R(red), G(green), B(blue) {}
+	bool operator==(RGB888 const & c) const { return R == c.R && G == c.G && B == c.B; }
+	bool operator!=(RGB888 const & c) const { return !(*this == c); }
+};
+
+struct Point {
+	int16_t X;
+	int16_t Y;
+
+	Point() : X(0), Y(0) {}
+	Point(int x, int y) : X(x), Y(y) {}
+};
+
+struct Rect {
+	int16_t X1;
+	int16_t Y1;
+	int16_t X2;
+	int16_t Y2;
+
+	Rect() : X1(0), Y1(0), X2(0), Y2(0) {}
+	Rect(int x1, int y1, int x2, int y2) : X1(x1), Y1(y1), X2(x2), Y2(y2) {}
+
+	int width() const { return X2 - X1 + 1; }
+	int height() const { return Y2 - Y1 + 1; }
+	bool intersects(Rect const & r) const { return X1 <= r.X2 && X2 >= r.X1 && Y1 <= r.Y2 && Y2 >= r.Y1; }
+	Rect merge(Rect const & r) const {
+		return Rect(std::min(X1, r.X1), std::min(Y1, r.Y1), std::max(X2, r.X2), std::max(Y2, r.Y2));
+	}
+	Rect intersection(Rect const & r) const {
+		return Rect(std::max(X1, r.X1), std::max(Y1, r.Y1), std::min(X2, r.X2), std::min(Y2, r.Y2));
+	}
+};
+
+enum class PaintMode {
+	Set, OR, AND, XOR, ORNOT, ANDNOT, XNOR, Invert, NoOp,
+};
+
+struct PaintOptions {
+	uint8_t		swapFGBG : 1;
+	uint8_t		NOT : 1;
+	PaintMode	mode;
+
+	PaintOptions() : swapFGBG(false), NOT(false), mode(PaintMode::Set) {}
+};
+
+enum class PixelFormat : uint8_t {
+	Undefined, Native, Mask, RGBA2222, RGBA8888,
+};
+
+struct Bitmap {
+	int16_t		width;
+	int16_t		height;
+	PixelFormat	format;
+	uint8_t *	data;
+
+	Bitmap() : width(0), height(0), format(PixelFormat::Undefined), data(nullptr) {}
+	Bitmap(int width_, int height_, void const * data_, PixelFormat format_)
+		: width(width_), height(height_), format(format_), data((uint8_t *) data_) {}
+};
+
+struct Sprite {
+	int16_t		x = 0;
+	int16_t		y = 0;
+	std::vector<Bitmap *> frames;
+	int16_t		framesCount = 0;
+	int16_t		currentFrame = 0;
+	PaintOptions paintOptions;
+	uint8_t		visible = 0;
+	uint8_t		allowDraw = 1;
+
+	// background saved by the last refresh, as fabgl keeps it
+	bool		saved = false;
+	Rect		savedRect;
+	std::vector<uint8_t> savedPixels;
+
+	Bitmap * getFrame() { return framesCount ? frames[currentFrame] : nullptr; }
+	int getWidth() { return frames[currentFrame]->width; }
+	int getHeight() { return frames[currentFrame]->height; }
+	Sprite * moveTo(int x_, int y_) { x = x_; y = y_; return this; }
+	Sprite * moveBy(int x_, int y_) { x += x_; y += y_; return this; }
+	Sprite * setFrame(int frame) { currentFrame = frame; return this; }
+	Sprite * nextFrame() { currentFrame = framesCount ? (currentFrame + 1) % framesCount : 0; return this; }
+	Sprite * addBitmap(Bitmap * bitmap) { frames.push_back(bitmap); framesCount++; return this; }
+	void clearBitmaps() { frames.clear(); framesCount = 0; currentFrame = 0; }
+};
+
+enum CursorName : uint8_t {
+	CursorPointerAmigaLike,
+	CursorPointerSimpleReduced,
+	CursorPointerSimple,
+	CursorPointerShadowed,
+	CursorPointer,
+	CursorPen,
+	CursorCross1,
+	CursorCross2,
+	CursorPoint,
+	CursorLeftArrow,
+	CursorRightArrow,
+	CursorDownArrow,
+	CursorUpArrow,
+	CursorMove,
+	CursorResize1,
+	CursorResize2,
+	CursorResize3,
+	CursorResize4,
+	CursorTextInput,
+};
+
+struct Cursor {
+	int16_t		hotspotX;
+	int16_t		hotspotY;
+	Bitmap		bitmap;
+};
+
+class VGABaseController {
+	public:
+		// rowBytes defaults to a byte per pixel
+		VGABaseController(int width, int height, int rowBytes = 0)
+			: m_width(width), m_height(height), m_screen((rowBytes ? rowBytes : width) * height, 0), m_rows(height) {
+			for (int y = 0; y < height; y++) {
+				m_rows[y] = &m_screen[y * (rowBytes ? rowBytes : width)];
+			}
+			m_viewPort = m_rows.data();
+		}
+
+		int getScreenWidth() { return m_width; }
+		int getScreenHeight() { return m_height; }
+		uint8_t * screen() { return m_screen.data(); }
+		size_t screenSize() { return m_screen.size(); }
+
+		void setSprites(Sprite * sprites, int count) { m_sprites = sprites; m_spritesCount = count; }
+		void removeSprites() { m_sprites = nullptr; m_spritesCount = 0; }
+		void setMouseCursor(Cursor * cursor) {}
+		void setMouseCursor(CursorName cursorName) {}
+
+		void refreshSprites() {
+			for (int i = m_spritesCount - 1; i >= 0; i--) {
+				auto &sprite = m_sprites[i];
+				if (sprite.allowDraw && sprite.saved) {
+					copyRect(sprite.savedRect, sprite.savedPixels, false);
+					sprite.saved = false;
+				}
+			}
+			for (int i = 0; i < m_spritesCount; i++) {
+				auto &sprite = m_sprites[i];
+				auto bitmap = sprite.getFrame();
+				if (!sprite.allowDraw || !sprite.visible || !bitmap) {
+					continue;
+				}
+				sprite.savedRect = Rect(sprite.x, sprite.y, sprite.x + bitmap->width - 1, sprite.y + bitmap->height - 1);
+				copyRect(sprite.savedRect, sprite.savedPixels, true);
+				sprite.saved = true;
+				drawBitmap(sprite.x, sprite.y, bitmap);
+			}
+		}
+
+		uint64_t	pixelsTouched = 0;
+
+	protected:
+		volatile uint8_t * * m_viewPort;
+
+	private:
+		int			m_width;
+		int			m_height;
+		std::vector<uint8_t> m_screen;
+		std::vector<volatile uint8_t *> m_rows;
+		Sprite *	m_sprites = nullptr;
+		int			m_spritesCount = 0;
+
+		// Save (or restore) the on-screen part of a rectangle
+		void copyRect(Rect rect, std::vector<uint8_t> &pixels, bool save) {
+			if (save) {
+				pixels.assign(rect.width() * rect.height(), 0);
+			}
+			for (int y = std::max<int>(rect.Y1, 0); y <= std::min<int>(rect.Y2, m_height - 1); y++) {
+				for (int x = std::max<int>(rect.X1, 0); x <= std::min<int>(rect.X2, m_width - 1); x++) {
+					auto &saved = pixels[(y - rect.Y1) * rect.width() + x - rect.X1];
+					auto &pixel = m_screen[y * m_width + x];
+					if (save) {
+						saved = pixel;
+					} else {
+						pixel = saved;
+					}
+					pixelsTouched++;
+				}
+			}
+		}
+
+		// Draw a bitmap of native pixel values, where 0 is transparent
+		void drawBitmap(int x0, int y0, Bitmap * bitmap) {
+			for (int y = std::max(y0, 0); y < std::min(y0 + bitmap->height, m_height); y++) {
+				for (int x = std::max(x0, 0); x < std::min(x0 + bitmap->width, m_width); x++) {
+					auto value = bitmap->data[(y - y0) * bitmap->width + x - x0];
+					if (value) {
+						m_screen[y * m_width + x] = value;
+					}
+					pixelsTouched++;
+				}
+			}
+		}
+};
+
+}	// namespace fabgl
+
+using namespace fabgl;
+
+#endif // HOST_FABGL_H
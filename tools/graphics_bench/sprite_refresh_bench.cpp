@@ -0,0 +1,157 @@
+//
+// Title:			Sprite refresh benchmark
+//
+// Runs the VDP's sprite refresh against a stand-in for fabgl's sprite compositor, with and
+// without dirty rectangle tracking (TEST_FLAG_SPRITE_DIRTY_RECTS), and reports the pixels
+// restored, saved and drawn per frame.
+//
+// Each scenario puts 16x16 sprites with transparent corners at random places on a 640x480
+// screen, then makes a number of random moves of a few pixels each frame, for 200 frames.
+// After every refresh the screen is checked against the background with every visible sprite
+// drawn over it in order.
+//
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+void debug_log(const char * format, ...) {
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+// sprites.h needs only a little of the screen, mouse and native bitmap code, so these stand in
+// for it rather than bringing in the whole of the display code
+#define AGON_PS2_H
+#define AGON_SCREEN_H
+#define NATIVE_BITMAP_H
+
+#include <fabgl.h>
+#include <memory>
+
+#include "agon.h"
+
+bool			mouseEnabled = false;
+std::unique_ptr<fabgl::VGABaseController>	_VGAController;
+uint16_t		nativeColourVersion = 0;
+uint16_t		nativeBitmapsVersion = 0;
+
+inline void waitPlotCompletion(bool waitForVSync = false) {}
+inline bool isDoubleBuffered() { return false; }
+inline void updateNativeBitmap(uint16_t bitmapId) {}
+inline void clearNativeBitmap(uint16_t bitmapId) {}
+inline void resetNativeBitmaps() {}
+inline void updateNativeBitmaps() {}
+
+#include "sprites.h"
+
+static const int width = 640;
+static const int height = 480;
+static const int spriteSize = 16;
+static const int frames = 200;
+
+struct Result {
+	double		pixelsPerFrame;
+	double		microsecondsPerFrame;
+	bool		match;
+};
+
+uint8_t backgroundPixel(int x, int y) {
+	return 0x80 | ((x ^ y) & 0x3F);
+}
+
+Result runScenario(int count, int moving, bool dirtyRects) {
+	if (dirtyRects) {
+		setTestFlag(TEST_FLAG_SPRITE_DIRTY_RECTS, 1);
+	} else {
+		clearTestFlag(TEST_FLAG_SPRITE_DIRTY_RECTS);
+	}
+	activateSprites(0);
+	for (int n = 0; n < MAX_SPRITES; n++) {
+		clearSpriteFrames(n);
+		sprites[n] = Sprite();
+	}
+	_VGAController = std::make_unique<fabgl::VGABaseController>(width, height);
+	auto screen = _VGAController->screen();
+	for (int y = 0; y < height; y++) {
+		for (int x = 0; x < width; x++) {
+			screen[y * width + x] = backgroundPixel(x, y);
+		}
+	}
+
+	// one bitmap per sprite, in its own colour, with the corners cut off
+	static std::vector<uint8_t> pixels[MAX_SPRITES];
+	std::mt19937 random(count * 1000 + moving);
+	for (int n = 0; n < count; n++) {
+		pixels[n].assign(spriteSize * spriteSize, 1 + n % 0x7F);
+		for (int i = 0; i < 4; i++) {
+			pixels[n][i] = pixels[n][spriteSize * spriteSize - 1 - i] = 0;
+		}
+		bitmaps[n] = std::make_shared<Bitmap>(spriteSize, spriteSize, pixels[n].data(), PixelFormat::Native);
+		setCurrentSprite(n);
+		addSpriteFrame(n);
+		moveSprite(random() % (width - spriteSize), random() % (height - spriteSize));
+		showSprite();
+	}
+	activateSprites(count);
+	refreshSprites();
+
+	std::vector<uint8_t> expected(width * height);
+	_VGAController->pixelsTouched = 0;
+	std::chrono::steady_clock::duration time {};
+	bool match = true;
+	for (int frame = 0; frame < frames; frame++) {
+		for (int i = 0; i < moving; i++) {
+			setCurrentSprite(random() % count);
+			auto sprite = getSprite();
+			int x = std::clamp<int>(sprite->x + (int)(random() % 9) - 4, 0, width - spriteSize);
+			int y = std::clamp<int>(sprite->y + (int)(random() % 9) - 4, 0, height - spriteSize);
+			moveSprite(x, y);
+		}
+		auto begin = std::chrono::steady_clock::now();
+		refreshSprites();
+		time += std::chrono::steady_clock::now() - begin;
+
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				expected[y * width + x] = backgroundPixel(x, y);
+			}
+		}
+		for (int n = 0; n < count; n++) {
+			auto sprite = getSprite(n);
+			for (int y = 0; y < spriteSize; y++) {
+				for (int x = 0; x < spriteSize; x++) {
+					if (auto value = pixels[n][y * spriteSize + x]) {
+						expected[(sprite->y + y) * width + sprite->x + x] = value;
+					}
+				}
+			}
+		}
+		match &= memcmp(expected.data(), screen, width * height) == 0;
+	}
+	return {
+		(double)_VGAController->pixelsTouched / frames,
+		std::chrono::duration<double>(time).count() * 1e6 / frames,
+		match,
+	};
+}
+
+int main() {
+	bool failed = false;
+	printf("sprites  moves   full refresh: pixels/frame  us/frame   dirty rects: pixels/frame  us/frame\n");
+	for (int count : { 64, 128, 255 }) {
+		for (int moving : { 0, 1, 4, 16, count }) {
+			auto full = runScenario(count, moving, false);
+			auto dirty = runScenario(count, moving, true);
+			failed |= !full.match || !dirty.match;
+			printf("%7d %6d   %26.0f %9.1f   %25.0f %9.1f   %s\n", count, moving,
+				full.pixelsPerFrame, full.microsecondsPerFrame, dirty.pixelsPerFrame, dirty.microsecondsPerFrame,
+				full.match && dirty.match ? "ok" : "MISMATCH");
+		}
+	}
+	return failed ? 1 : 0;
+}
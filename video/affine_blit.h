@@ -0,0 +1,237 @@
+#ifndef AFFINE_BLIT_H
+#define AFFINE_BLIT_H
+
+// Affine transformed bitmap draws
+// Transforms are 3x3 float matrices held in buffers.  Each buffer's matrix is cached along with
+// its inverse, in float for fabgl and in 16.16 fixed point for the direct framebuffer kernel.
+// Cached transforms are dropped when their buffer is cleared, replaced or written to, and the
+// cached copy of the matrix is compared with the buffer on every use, so changes made in place
+// (such as by an adjust command) are picked up too.
+//
+// The direct kernel steps through source coordinates in fixed point, working out for each
+// destination row which span of pixels lands inside the bitmap, so only that span is visited.
+// It samples as fabgl's drawTransformedBitmap does: each destination pixel's integer coordinates
+// are transformed, and the result truncated towards zero.
+//
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string.h>
+#include <unordered_map>
+#include <fabgl.h>
+
+#include "agon.h"
+#include "agon_screen.h"
+#include "bitmap_blit.h"
+#include "buffers.h"
+#include "framebuffer.h"
+#include "types.h"
+
+struct AffineTransform {
+	float		matrix[9];				// Copy of the buffer's matrix, row major
+	float		inverse[9];
+	int32_t		fixedInverse[6];		// Top two rows of the inverse, 16.16 fixed point
+	bool		invertible;
+	bool		affine;					// Bottom row is 0, 0, 1, so the fixed point kernel can be used
+	bool		used;					// Passed to fabgl, so may be referenced by a queued draw
+};
+
+std::unordered_map<uint16_t, AffineTransform> affineTransforms;	// Cached transforms, by buffer ID
+
+void updateAffineTransform(AffineTransform &transform, const float * matrix) {
+	if (transform.used) {
+		// a queued draw may still be reading our matrices
+		waitPlotCompletion();
+	}
+	memcpy(transform.matrix, matrix, sizeof(transform.matrix));
+	transform.used = false;
+	auto m = transform.matrix;
+	auto &inv = transform.inverse;
+
+	// inverse from the adjugate
+	inv[0] = m[4] * m[8] - m[5] * m[7];
+	inv[1] = m[2] * m[7] - m[1] * m[8];
+	inv[2] = m[1] * m[5] - m[2] * m[4];
+	inv[3] = m[5] * m[6] - m[3] * m[8];
+	inv[4] = m[0] * m[8] - m[2] * m[6];
+	inv[5] = m[2] * m[3] - m[0] * m[5];
+	inv[6] = m[3] * m[7] - m[4] * m[6];
+	inv[7] = m[1] * m[6] - m[0] * m[7];
+	inv[8] = m[0] * m[4] - m[1] * m[3];
+	auto det = m[0] * inv[0] + m[1] * inv[3] + m[2] * inv[6];
+	transform.invertible = det != 0 && std::isfinite(det);
+	if (!transform.invertible) {
+		return;
+	}
+	for (auto &value : inv) {
+		value /= det;
+	}
+
+	transform.affine = m[6] == 0 && m[7] == 0 && m[8] == 1;
+	for (auto i = 0; i < 6; i++) {
+		auto value = inv[i] * 65536.0f;
+		if (!(std::fabs(value) < 2147483647.0f)) {
+			// too large for fixed point
+			transform.affine = false;
+			break;
+		}
+		transform.fixedInverse[i] = (int32_t)std::lround(value);
+	}
+}
+
+// Drop the cached transform for a buffer
+//
+void clearAffineTransform(uint16_t bufferId) {
+	auto cached = affineTransforms.find(bufferId);
+	if (cached != affineTransforms.end()) {
+		if (cached->second.used) {
+			// a queued draw may still be reading its matrices
+			waitPlotCompletion();
+		}
+		affineTransforms.erase(cached);
+	}
+}
+
+void resetAffineTransforms() {
+	waitPlotCompletion();
+	affineTransforms.clear();
+}
+
+// Get the cached transform for a buffer, refreshing it if the buffer's matrix has changed
+// Returns nullptr if the buffer doesn't hold a matrix
+//
+AffineTransform * getAffineTransform(uint16_t bufferId) {
+	auto bufferIter = buffers.find(bufferId);
+	if (bufferIter == buffers.end() || bufferIter->second.empty()) {
+		return nullptr;
+	}
+	auto &block = bufferIter->second[0];
+	if (block->size() < sizeof(float) * 9) {
+		debug_log("getAffineTransform: transform buffer %d has %d bytes\n\r", bufferId, block->size());
+		return nullptr;
+	}
+	auto matrix = (const float *)block->getBuffer();
+	auto cached = affineTransforms.find(bufferId);
+	if (cached == affineTransforms.end()) {
+		auto &transform = affineTransforms[bufferId];
+		transform.used = false;
+		updateAffineTransform(transform, matrix);
+		return &transform;
+	}
+	if (memcmp(cached->second.matrix, matrix, sizeof(cached->second.matrix)) != 0) {
+		updateAffineTransform(cached->second, matrix);
+	}
+	return &cached->second;
+}
+
+// Divide rounding down or up, for 64-bit values with a non-zero divisor
+static inline int64_t floorDiv64(int64_t a, int64_t b) {
+	auto q = a / b;
+	return (q * b != a && ((a < 0) != (b < 0))) ? q - 1 : q;
+}
+
+static inline int64_t ceilDiv64(int64_t a, int64_t b) {
+	auto q = a / b;
+	return (q * b != a && ((a < 0) == (b < 0))) ? q + 1 : q;
+}
+
+// Narrow [first, last] to the steps k where start + k * step lies in [0, limit)
+//
+static inline void clipSpan(int64_t start, int64_t step, int64_t limit, int64_t &first, int64_t &last) {
+	if (step == 0) {
+		if (start < 0 || start >= limit) {
+			last = first - 1;
+		}
+		return;
+	}
+	int64_t low, high;
+	if (step > 0) {
+		low = ceilDiv64(-start, step);
+		high = floorDiv64(limit - 1 - start, step);
+	} else {
+		low = ceilDiv64(limit - 1 - start, step);
+		high = floorDiv64(-start, step);
+	}
+	first = std::max(first, low);
+	last = std::min(last, high);
+}
+
+// Draw a bitmap through an affine transform straight into the framebuffer, clipped to a rectangle
+// (x, y) is the destination of the bitmap's origin
+// Returns false if the bitmap or transform can't be drawn this way, in which case nothing has been drawn
+//
+bool blitTransformedBitmap(uint16_t bitmapId, std::shared_ptr<Bitmap> bitmap, int x, int y, const AffineTransform &transform, const Rect &clip) {
+	if (!transform.affine) {
+		return false;
+	}
+	auto blit = getBlitBitmap(bitmapId, bitmap);
+	if (!blit || blit->type == BitmapClass::Alpha) {
+		return false;
+	}
+
+	// destination bounds, from the transformed corners of the bitmap
+	// source coordinates between -1 and 0 truncate to 0, so the corners are a pixel further out
+	auto m = transform.matrix;
+	int width = bitmap->width;
+	int height = bitmap->height;
+	float minX = INFINITY, minY = INFINITY, maxX = -INFINITY, maxY = -INFINITY;
+	for (auto corner = 0; corner < 4; corner++) {
+		float u = (corner & 1) ? width : -1;
+		float v = (corner & 2) ? height : -1;
+		float dx = m[0] * u + m[1] * v + m[2];
+		float dy = m[3] * u + m[4] * v + m[5];
+		minX = std::min(minX, dx);
+		maxX = std::max(maxX, dx);
+		minY = std::min(minY, dy);
+		maxY = std::max(maxY, dy);
+	}
+	int x1 = std::max(std::max((int)std::floor(minX) + x, (int)clip.X1), 0);
+	int y1 = std::max(std::max((int)std::floor(minY) + y, (int)clip.Y1), 0);
+	int x2 = std::min(std::min((int)std::ceil(maxX) + x, (int)clip.X2), canvasW - 1);
+	int y2 = std::min(std::min((int)std::ceil(maxY) + y, (int)clip.Y2), canvasH - 1);
+	if (x1 > x2 || y1 > y2) {
+		return true;
+	}
+
+	waitPlotCompletion();
+	auto depth = getVGAColourDepth();
+	auto inv = transform.fixedInverse;
+	auto maskRowBytes = (width + 7) >> 3;
+	// coordinates truncate into the bitmap from just above -1 up to just below its size,
+	// so spans are clipped with coordinates offset by just under one
+	const int64_t bias = 0xFFFF;
+	const int64_t uLimit = ((int64_t)width << 16) + bias;
+	const int64_t vLimit = ((int64_t)height << 16) + bias;
+
+	for (int py = y1; py <= y2; py++) {
+		// source position of the first pixel on this row
+		int64_t rx = (int64_t)(x1 - x) * 65536;
+		int64_t ry = (int64_t)(py - y) * 65536;
+		int64_t u = ((inv[0] * rx + inv[1] * ry) >> 16) + inv[2];
+		int64_t v = ((inv[3] * rx + inv[4] * ry) >> 16) + inv[5];
+
+		int64_t first = 0;
+		int64_t last = x2 - x1;
+		clipSpan(u + bias, inv[0], uLimit, first, last);
+		clipSpan(v + bias, inv[3], vLimit, first, last);
+		if (first > last) {
+			continue;
+		}
+
+		auto row = getFramebufferRow(py);
+		u += first * inv[0];
+		v += first * inv[3];
+		for (auto k = first; k <= last; k++, u += inv[0], v += inv[3]) {
+			int sx = u / 65536;
+			int sy = v / 65536;
+			if (blit->type == BitmapClass::ColourKey && !(blit->mask[sy * maskRowBytes + (sx >> 3)] & (0x80 >> (sx & 7)))) {
+				continue;
+			}
+			setNativePixel(row, x1 + k, depth, blit->pixels[sy * width + sx]);
+		}
+	}
+	return true;
+}
+
+#endif // AFFINE_BLIT_H
@@ -119,6 +119,7 @@
 #define AUDIO_CMD_DURATION		12		// Set the duration of a channel
 #define AUDIO_CMD_SAMPLERATE	13		// Set the samplerate for channel or underlying audio system
 #define AUDIO_CMD_SET_PARAM		14		// Set a waveform parameter
+#define AUDIO_CMD_SEQUENCER		15		// Music sequencer control
 
 #define AUDIO_WAVE_DEFAULT		0		// Default waveform (Square wave)
 #define AUDIO_WAVE_SQUARE		0		// Square wave
@@ -128,6 +129,7 @@
 #define AUDIO_WAVE_NOISE		4		// Noise (simple, no frequency support)
 #define AUDIO_WAVE_VICNOISE		5		// VIC-style noise (supports frequency)
 #define AUDIO_WAVE_SAMPLE		8		// Sample playback, explicit buffer ID sent in following 2 bytes
+#define AUDIO_WAVE_WAVETABLE	9		// Wavetable, from a buffer of 256 (or 512 to morph) 8-bit signed values, buffer ID sent in following 2 bytes
 // negative values for waveforms indicate a sample number
 
 #define AUDIO_SAMPLE_LOAD		0		// Send a sample to the VDP
@@ -139,16 +141,21 @@
 #define AUDIO_SAMPLE_BUFFER_SET_REPEAT_START	6	// Set the repeat start point of a sample (using buffer ID)
 #define AUDIO_SAMPLE_SET_REPEAT_LENGTH			7	// Set the repeat length of a sample
 #define AUDIO_SAMPLE_BUFFER_SET_REPEAT_LENGTH	8	// Set the repeat length of a sample (using buffer ID)
+#define AUDIO_SAMPLE_STREAM_FROM_BUFFER			9	// Stream a sample from a buffer as it is written to
 #define AUDIO_SAMPLE_DEBUG_INFO 0x10	// Get debug info about a sample
 
 #define AUDIO_DEFAULT_FREQUENCY	523		// Default sample frequency (C5, or C above middle C)
 
 #define AUDIO_FORMAT_8BIT_SIGNED	0	// 8-bit signed sample
 #define AUDIO_FORMAT_8BIT_UNSIGNED	1	// 8-bit unsigned sample
+#define AUDIO_FORMAT_16BIT_SIGNED	2	// 16-bit signed sample, little-endian
+#define AUDIO_FORMAT_ADPCM			3	// IMA ADPCM, 4 bits per sample, in blocks of AUDIO_ADPCM_BLOCK_SIZE bytes
 #define AUDIO_FORMAT_DATA_MASK		7	// data bit mask for format
 #define AUDIO_FORMAT_WITH_RATE		8	// OR this with the format to indicate a sample rate follows
 #define AUDIO_FORMAT_TUNEABLE		16	// OR this with the format to indicate sample can be tuned (frequency adjustable)
 
+#define AUDIO_ADPCM_BLOCK_SIZE		256	// Bytes per ADPCM block, laid out as in mono IMA ADPCM WAV files
+
 #define AUDIO_ENVELOPE_NONE			0		// No envelope
 #define AUDIO_ENVELOPE_ADSR			1		// Simple ADSR volume envelope
 #define AUDIO_ENVELOPE_MULTIPHASE_ADSR		2		// Multi-phase ADSR envelope
@@ -162,14 +169,35 @@
 #define AUDIO_PARAM_DUTY_CYCLE		0		// Square wave duty cycle
 #define AUDIO_PARAM_VOLUME			2		// Volume
 #define AUDIO_PARAM_FREQUENCY		3		// Frequency
+#define AUDIO_PARAM_INTERPOLATION	4		// Sample interpolation mode
+#define AUDIO_PARAM_MORPH			5		// Wavetable morph, from the first table (0) towards the second (255)
 #define AUDIO_PARAM_16BIT			0x80	// 16-bit value
 #define AUDIO_PARAM_MASK			0x0F	// Parameter mask
 
+#define AUDIO_INTERPOLATION_LINEAR	0		// Linear interpolation between sample points
+#define AUDIO_INTERPOLATION_HERMITE	1		// 4-point Hermite interpolation, smoother but slower
+
 #define AUDIO_STATUS_ACTIVE		0x01	// Has an active waveform
 #define AUDIO_STATUS_PLAYING	0x02	// Playing a note (not in release phase)
 #define AUDIO_STATUS_INDEFINITE	0x04	// Indefinite duration sound playing
 #define AUDIO_STATUS_HAS_VOLUME_ENVELOPE	0x08	// Channel has a volume envelope set
 #define AUDIO_STATUS_HAS_FREQUENCY_ENVELOPE	0x10	// Channel has a frequency envelope set
+#define AUDIO_STATUS_STREAM_LOW	0x20	// Streaming sample is running low on data
+
+#define AUDIO_SEQUENCER_LOAD		0		// Load a song from a buffer, to play from the given channel
+#define AUDIO_SEQUENCER_START		1		// Start playing the song
+#define AUDIO_SEQUENCER_STOP		2		// Stop playing, and silence the song's channels
+#define AUDIO_SEQUENCER_TEMPO		3		// Set the tempo, in beats per minute
+#define AUDIO_SEQUENCER_SET_POSITION	4	// Set the order position and row to play next
+#define AUDIO_SEQUENCER_GET_ORDER	5		// Get the order position
+#define AUDIO_SEQUENCER_GET_ROW		6		// Get the row to play next
+
+#define AUDIO_SEQUENCER_FX_NONE			0	// No effect
+#define AUDIO_SEQUENCER_FX_DUTY_CYCLE	1	// Set square wave duty cycle
+#define AUDIO_SEQUENCER_FX_TEMPO		2	// Set tempo, in beats per minute
+
+#define AUDIO_SEQUENCER_NOTE_OFF		255	// Note value to end a note
+#define AUDIO_SEQUENCER_NO_VOLUME		255	// Volume value to leave volume unchanged
 
 // Mouse commands
 #define MOUSE_ENABLE			0		// Enable mouse
@@ -350,12 +378,27 @@
 #define AFFINE_FORMAT_FIXED		0x40	// if set, values are fixed-point, vs floats
 #define AFFINE_FORMAT_16BIT		0x80	// if set, values are 16-bit, vs 32-bit
 
+// Sprite update record format, for batched sprite updates from a buffer
+// Each record is: sprite ID, X; Y; frame, flags
+#define SPRITE_UPDATE_RECORD_SIZE	7	// Size of a single sprite update record
+#define SPRITE_UPDATE_MOVE_TO	0x01	// Move sprite to X, Y
+#define SPRITE_UPDATE_MOVE_BY	0x02	// Move sprite by X, Y (ignored if MOVE_TO set)
+#define SPRITE_UPDATE_FRAME	0x04	// Set current frame
+#define SPRITE_UPDATE_SHOW	0x08	// Show sprite
+#define SPRITE_UPDATE_HIDE	0x10	// Hide sprite (ignored if SHOW set)
+
+// Sprite collision detection flags
+#define SPRITE_COLLISION_PIXELS	0x01	// Check opaque pixels overlap, rather than just bounding boxes
+
 // Buffered bitmap and sample info
 #define BUFFERED_BITMAP_BASEID	0xFA00	// Base ID for buffered bitmaps
 #define BUFFERED_SAMPLE_BASEID	0xFB00	// Base ID for buffered samples
 
 // Test flags
 #define TEST_FLAG_AFFINE_TRANSFORM	1	// Affine transform test flag
+#define TEST_FLAG_NATIVE_BITMAPS	2	// Convert RGBA8888 bitmaps to native format
+#define TEST_FLAG_SPRITE_DIRTY_RECTS	3	// Only redraw sprites affected by changes on refresh
+#define TEST_FLAG_DIRECT_BLIT		4	// Write opaque and colour-keyed bitmaps straight to the framebuffer
 
 #define LOGICAL_SCRW			1280	// As per the BBC Micro standard
 #define LOGICAL_SCRH			1024
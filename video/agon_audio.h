@@ -23,39 +23,14 @@ std::mutex soundGeneratorMutex;
 #include "audio_sample.h"
 #include "types.h"
 
-// audio channels and their associated tasks
+// audio channels, which are run by the mixer as it renders them
 AudioChannel *audioChannels[MAX_AUDIO_CHANNELS];
-TaskHandle_t audioTask;
 std::unordered_map<uint16_t, std::shared_ptr<AudioSample>> samples;	// Storage for the sample data
 fabgl::SoundGenerator *soundGenerator;  // audio handling sub-system
 
 extern void force_debug_log(const char *format, ...);
 bool channelEnabled(uint8_t channel);
 
-// Audio channel driver task
-//
-void audioDriver(void * parameters) {
-	while (true) {
-		auto now = millis();
-		for (int i=0; i<MAX_AUDIO_CHANNELS; i++) {
-			if (audioChannels[i]) {
-				audioChannels[i]->loop(now);
-			}
-		}
-		vTaskDelay(pdMS_TO_TICKS(1));
-	}
-}
-
-BaseType_t initAudioTask() {
-	return xTaskCreatePinnedToCore(audioDriver, "audioDriver",
-		2048,
-		nullptr,
-		AUDIO_CHANNEL_PRIORITY,		// Priority, with 3 (configMAX_PRIORITIES - 1) being the highest, and 0 being the lowest.
-		&audioTask,
-		AUDIO_CORE
-	);
-}
-
 BaseType_t initAudioChannel(int channel) {
 	if (!channelEnabled(channel)) {
 		audioChannels[channel] = new AudioChannel(channel);
@@ -80,6 +55,8 @@ void setSampleRate(uint16_t sampleRate) {
 			delete soundGenerator;
 		}
 		soundGenerator = new fabgl::SoundGenerator(sampleRate);
+		// channels are mixed by our mixer, which is the only generator fabgl sees
+		soundGenerator->attach(&audioMixer);
 	}
 	for (int chan=0; chan<MAX_AUDIO_CHANNELS; chan++) {
 		if (audioChannels[chan]) {
@@ -100,7 +77,6 @@ void initAudio() {
 	for (uint8_t i = 0; i < AUDIO_CHANNELS; i++) {
 		initAudioChannel(i);
 	}
-	initAudioTask();
 }
 
 // Channel enabled?
@@ -235,6 +211,18 @@ uint8_t clearSample(uint16_t sampleId) {
 	return 0;
 }
 
+// Add a block of data to a streaming sample
+// Returns true if the buffer feeds a stream, in which case the block belongs to the stream
+//
+bool appendToSampleStream(uint16_t bufferId, std::shared_ptr<BufferStream> block) {
+	auto sample = samples.find(bufferId);
+	if (sample == samples.end() || !sample->second || !sample->second->isStream()) {
+		return false;
+	}
+	sample->second->append(block);
+	return true;
+}
+
 // Reset samples
 //
 void resetSamples() {
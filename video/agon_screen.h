@@ -11,6 +11,7 @@
 std::unique_ptr<fabgl::Canvas>	canvas;			// The canvas class
 std::unique_ptr<fabgl::VGABaseController>	_VGAController;		// Pointer to the current VGA controller class
 
+#include "canvas_state.h"
 #include "agon_ttxt.h"
 
 bool			legacyModes = false;			// Default legacy modes being false
@@ -22,6 +23,7 @@ double			logicalScaleX;					// Scaling factor for logical coordinates
 double			logicalScaleY;
 bool			rectangularPixels = false;		// Pixels are square by default
 uint8_t			videoMode;						// Current video mode
+uint16_t		nativeColourVersion = 0;		// Incremented whenever native pixel values may map to different colours
 
 extern void debug_log(const char * format, ...);		// Debug log function
 
@@ -72,6 +74,7 @@ inline uint8_t getVGAColourDepth() {
 void setPaletteItem(uint8_t l, RGB888 c) {
 	auto depth = getVGAColourDepth();
 	if (l < depth) {
+		nativeColourVersion++;
 		// Use instance, as call not present on VGABaseController
 		switch (depth) {
 			case 2: fabgl::VGA2Controller::instance()->setPaletteItem(l, c); break;
@@ -191,6 +194,8 @@ int8_t changeResolution(uint8_t colours, const char * modeLine, bool doubleBuffe
 		return 1;									// Return the error
 	}
 
+	canvasState.invalidate();						// Forget tracked state for the old canvas
+	nativeColourVersion++;							// Native pixel values change meaning with the mode
 	canvas.reset();									// Delete the canvas
 
 	if (modeLine) {									// If modeLine is not a null pointer then
@@ -114,8 +114,8 @@ void agon_ttxt::display_char(int col, int row, unsigned char c)
       ((m_stateFlags & TTXT_STATE_FLAG_DHLOW) && !(m_stateFlags & TTXT_STATE_FLAG_HEIGHT)) ||
       ((m_stateFlags & TTXT_STATE_FLAG_FLASH) && !m_flashPhase))
     c = 32;
-  canvas->setPenColor(m_fg);
-  canvas->setBrushColor(m_bg);
+  canvasState.setPenColor(m_fg);
+  canvasState.setBrushColor(m_bg);
   canvas->drawChar(col*16, row*m_font.height, c);
 }
 
@@ -646,8 +646,8 @@ void agon_ttxt::flash(bool f)
   {
     if (m_lastRow >= 0) 
       process_line(m_lastRow, m_lastCol, AGON_TTXT_OP_SCAN);
-    canvas->setBrushColor(oldbg);
-    canvas->setPenColor(oldfg);
+    canvasState.setBrushColor(oldbg);
+    canvasState.setPenColor(oldfg);
   }
 }
 
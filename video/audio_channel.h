@@ -1,33 +1,55 @@
 #ifndef AUDIO_CHANNEL_H
 #define AUDIO_CHANNEL_H
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 #include <mutex>
+#include <string.h>
 #include <fabgl.h>
 
 #include "agon.h"
+#include "buffers.h"
 #include "types.h"
+#include "waveform_generators.h"
 #include "envelopes/types.h"
 
 extern fabgl::SoundGenerator *soundGenerator;  // audio handling sub-system
 
 enum class AudioState : uint8_t {	// Audio channel state
 	Idle = 0,				// currently idle/silent
-	Pending,				// note will be played next loop call
+	Pending,				// note will be played from the next rendered sample
 	Playing,				// playing (passive)
 	PlayLoop,				// active playing loop (used when an envelope is active)
 	Release,				// in "release" phase
 	Abort					// aborting a note
 };
 
+// Parameter changes posted by the VDU side, which the mixer applies at the start of its next block
+#define AUDIO_CHANGE_VOLUME		0x01
+#define AUDIO_CHANGE_FREQUENCY	0x02
+#define AUDIO_CHANGE_DUTY_CYCLE	0x04
+#define AUDIO_CHANGE_CURTAIL	0x08	// Volume set to zero whilst looping, so end the note now
+#define AUDIO_CHANGE_MORPH		0x10
+
+#define AUDIO_NO_ROW_EVENT		0xFFFFFFFF	// No sequencer event waiting for the channel
+
 // The audio channel class
+// Notes, volume, frequency, duty cycle and status are passed between the VDU and the mixer through
+// atomics, so neither side waits for the other.  A new note is written to the _note slots and then
+// handed over by moving the state to Pending, and other changes are flagged in _changes.  The mixer
+// publishes the channel's status in _status after each block.
+// Sequencer events are posted to _rowEvent by the mixer, and played when the channel next renders.
+// Changes that replace the waveform or envelopes, which the mixer uses whilst rendering, still take
+// the channel lock.
 //
 class AudioChannel {
 	public:
 		AudioChannel(uint8_t channel);
 		~AudioChannel();
 		uint8_t		playNote(uint8_t volume, uint16_t frequency, int32_t duration);
+		void		postRowEvent(const uint8_t * event);
 		uint8_t		getStatus();
 		uint8_t		setWaveform(int8_t waveformType, uint16_t sampleId = 0);
 		uint8_t		setVolume(uint8_t volume);
@@ -37,11 +59,12 @@ class AudioChannel {
 		uint8_t		setFrequencyEnvelope(std::unique_ptr<FrequencyEnvelope> envelope);
 		uint8_t		setSampleRate(uint16_t sampleRate);
 		uint8_t		setDutyCycle(uint8_t dutyCycle);
+		uint8_t		setMorph(uint8_t morph);
 		uint8_t		setParameter(uint8_t parameter, uint16_t value);
 		void		attachSoundGenerator();
 		void		detachSoundGenerator();
 		uint8_t		seekTo(uint32_t position);
-		void		loop(uint64_t now);
+		bool		render(int16_t * buffer, int count, uint64_t now, int & volume);
 		uint8_t		channel() { return _channel; }
 		void            goIdle();
 		std::unique_lock<std::mutex> lock() { return std::unique_lock<std::mutex>(_channelMutex); }
@@ -49,35 +72,62 @@ class AudioChannel {
 		uint8_t		_seekTo(uint32_t position);
 		void            _goIdle();
 		WaveformGenerator *getSampleWaveform(uint16_t sampleId, AudioChannel *channelRef);
+		WaveformGenerator *getWavetableWaveform(uint16_t bufferId);
 		uint8_t		_getVolume(uint32_t elapsed);
 		uint16_t	_getFrequency(uint32_t elapsed);
 		bool		_isReleasing(uint32_t elapsed);
 		bool		_isFinished(uint32_t elapsed);
+		uint32_t	_getNextChange(uint32_t elapsed);
+		uint32_t	_followVolume(uint32_t elapsed, uint64_t now);
+		uint32_t	_elapsed(uint64_t now);
+		uint64_t	_sampleAt(uint32_t time);
+		uint32_t	_samplesUntil(uint32_t time, uint64_t now);
+		uint32_t	_update(uint64_t now);
+		bool		_setState(AudioState from, AudioState to);
+		void		_postNote(uint8_t volume, uint16_t frequency, int32_t duration);
+		void		_triggerNote(uint8_t volume, uint16_t frequency);
+		void		_playRowEvent(uint32_t event);
+		void		_applyChanges(uint8_t changes, uint64_t now);
 		uint8_t		_channel;
-		uint8_t		_volume;
-		uint16_t	_frequency;
-		int32_t		_duration;
-		uint64_t	_startTime;
+		std::atomic<uint8_t>	_volume;
+		std::atomic<uint16_t>	_frequency;
+		std::atomic<int32_t>	_duration;
+		std::atomic<uint8_t>	_noteVolume;		// Next note to play, copied when leaving Pending
+		std::atomic<uint16_t>	_noteFrequency;
+		std::atomic<int32_t>	_noteDuration;
+		std::atomic<uint8_t>	_dutyCycle;
+		std::atomic<uint8_t>	_morph;
+		std::atomic<uint8_t>	_changes;			// AUDIO_CHANGE flags waiting for the mixer
+		std::atomic<uint8_t>	_status;			// Status as of the last rendered block
+		std::atomic<uint32_t>	_rowEvent;			// Sequencer event to play, or AUDIO_NO_ROW_EVENT
+		uint64_t	_startTime;			// Mixer clock when the note started, in samples
 		uint8_t		_waveformType;
-		AudioState	_state;
+		std::atomic<AudioState>	_state;
 		std::unique_ptr<WaveformGenerator>	_waveform;
+		BlockWaveformGenerator *		_blockWaveform = nullptr;	// _waveform, if it can render a block at a time
 		std::mutex                              _channelMutex;
 		std::unique_ptr<VolumeEnvelope>		_volumeEnvelope;
 		std::unique_ptr<FrequencyEnvelope>	_frequencyEnvelope;
 };
 
+#include "audio_mixer.h"
 #include "audio_sample.h"
 #include "enhanced_samples_generator.h"
 extern std::unordered_map<uint16_t, std::shared_ptr<AudioSample>> samples;	// Storage for the sample data
 
-AudioChannel::AudioChannel(uint8_t channel) : _waveform(nullptr), _channel(channel), _state(AudioState::Idle), _volume(64), _frequency(750), _duration(-1) {
+AudioChannel::AudioChannel(uint8_t channel) : _channel(channel), _volume(64), _frequency(750), _duration(-1),
+	_noteVolume(64), _noteFrequency(750), _noteDuration(-1), _dutyCycle(127), _morph(0), _changes(0), _status(0), _rowEvent(AUDIO_NO_ROW_EVENT),
+	_state(AudioState::Idle), _waveform(nullptr)
+{
 	debug_log("AudioChannel: init %d\n\r", channel);
 	setWaveform(AUDIO_WAVE_DEFAULT);
+	audioMixer.addChannel(channel, this);
 	debug_log("free mem: %d\n\r", heap_caps_get_free_size(MALLOC_CAP_8BIT));
 }
 
 AudioChannel::~AudioChannel() {
 	debug_log("AudioChannel: deiniting %d\n\r", channel());
+	audioMixer.removeChannel(_channel);
 	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	detachSoundGenerator();
 	debug_log("AudioChannel: deinit %d\n\r", channel());
@@ -85,11 +135,9 @@ AudioChannel::~AudioChannel() {
 
 void AudioChannel::goIdle() {
 	debug_log("AudioChannel: abort %d\n\r", channel());
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
-	if (this->_waveform) {
-		this->_waveform->enable(false);
-	}
-	this->_state = AudioState::Idle;
+	// the mixer silences the channel at its next block
+	auto state = this->_state.load();
+	while (state != AudioState::Idle && !this->_state.compare_exchange_weak(state, AudioState::Abort)) {}
 }
 
 // expects the lock to already be held
@@ -102,55 +150,112 @@ void AudioChannel::_goIdle() {
 }
 
 uint8_t AudioChannel::playNote(uint8_t volume, uint16_t frequency, int32_t duration) {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	if (!this->_waveform) {
 		debug_log("AudioChannel: no waveform on channel %d\n\r", channel());
 		return 0;
 	}
-	if (this->_waveformType == AUDIO_WAVE_SAMPLE && this->_volume == 0 && this->_state != AudioState::Idle) {
-		// we're playing a silenced sample, so we're free to play a new note, so abort
-		this->_goIdle();
+	auto state = this->_state.load();
+	// if we're playing a silenced sample we're free to play a new note over it
+	bool silencedSample = this->_waveformType == AUDIO_WAVE_SAMPLE && this->_volume == 0 && state != AudioState::Idle;
+	if (!silencedSample && state != AudioState::Idle && state != AudioState::Release) {
+		return 0;
 	}
-	switch (this->_state) {
-		case AudioState::Idle:
-		case AudioState::Release:
-			this->_volume = volume;
-			this->_frequency = frequency;
-			this->_duration = duration == 65535 ? -1 : duration;
-			if (this->_duration == 0 && this->_waveformType == AUDIO_WAVE_SAMPLE) {
-				// zero duration means play whole sample
-				// NB this can only work out sample duration based on sample provided
-				// so if sample data is streaming in an explicit length should be used instead
-				this->_duration = ((EnhancedSamplesGenerator *)&*_waveform)->getDuration(frequency);
-				if (this->_volumeEnvelope) {
-					// subtract the "release" time from the duration
-					this->_duration -= this->_volumeEnvelope->getRelease();
-				}
-				if (this->_duration < 0) {
-					this->_duration = 1;
-				}
+	int32_t noteDuration = duration == 65535 ? -1 : duration;
+	if (noteDuration == 0 && this->_waveformType == AUDIO_WAVE_SAMPLE) {
+		// zero duration means play whole sample
+		// NB this can only work out sample duration based on sample provided
+		// so if sample data is streaming in an explicit length should be used instead
+		auto samplesGenerator = (EnhancedSamplesGenerator *)&*_waveform;
+		if (samplesGenerator->isStream()) {
+			// a stream has no end, so plays until stopped
+			noteDuration = -1;
+		} else {
+			noteDuration = samplesGenerator->getDuration(frequency);
+			if (this->_volumeEnvelope) {
+				// subtract the "release" time from the duration
+				noteDuration -= this->_volumeEnvelope->getRelease();
+			}
+			if (noteDuration < 0) {
+				noteDuration = 1;
 			}
-			this->_state = AudioState::Pending;
-			debug_log("AudioChannel: playNote %d,%d,%d,%d\n\r", channel(), volume, frequency, this->_duration);
-			return 1;
+		}
 	}
-	return 0;
+	_postNote(volume, frequency, noteDuration);
+	// the mixer may have ended a release meanwhile, which still leaves us free to play
+	while (!this->_state.compare_exchange_weak(state, AudioState::Pending)) {
+		if (!silencedSample && state != AudioState::Idle && state != AudioState::Release) {
+			return 0;
+		}
+	}
+	debug_log("AudioChannel: playNote %d,%d,%d,%d\n\r", channel(), volume, frequency, noteDuration);
+	return 1;
 }
 
-uint8_t AudioChannel::getStatus() {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
-	uint8_t status = 0;
-	if (this->_waveform && this->_waveform->enabled()) {
-		status |= AUDIO_STATUS_ACTIVE;
-		if (this->_duration == -1) {
-			status |= AUDIO_STATUS_INDEFINITE;
-		}
+// Post a sequencer event (note, volume, effect, parameter), to play from the channel's next rendered sample
+// Used by the sequencer, which runs in the mixer between channel renders, so this never touches the waveform
+// An event that hasn't been played yet is replaced
+void AudioChannel::postRowEvent(const uint8_t * event) {
+	// only channel effects are passed on, which also keeps an event from matching AUDIO_NO_ROW_EVENT
+	uint8_t effect = event[2] == AUDIO_SEQUENCER_FX_DUTY_CYCLE ? event[2] : AUDIO_SEQUENCER_FX_NONE;
+	this->_rowEvent = event[0] | (event[1] << 8) | (effect << 16) | ((uint32_t)event[3] << 24);
+}
+
+// caller must hold channel lock
+// Play a sequencer event posted by postRowEvent
+void AudioChannel::_playRowEvent(uint32_t event) {
+	uint8_t note = event & 0xFF;
+	uint8_t volume = (event >> 8) & 0xFF;
+	uint8_t effect = (event >> 16) & 0xFF;
+	uint8_t parameter = event >> 24;
+
+	// effects come first, so they apply to this row's note
+	if (effect == AUDIO_SEQUENCER_FX_DUTY_CYCLE) {
+		setDutyCycle(parameter);
+	}
+	if (note == AUDIO_SEQUENCER_NOTE_OFF) {
+		setVolume(0);
+	} else if (note > 0 && note < 128) {
+		_triggerNote(volume == AUDIO_SEQUENCER_NO_VOLUME ? 255 : volume, AudioSequencer::noteFrequency(note));
+	} else if (volume != AUDIO_SEQUENCER_NO_VOLUME) {
+		setVolume(volume);
+	}
+}
+
+// caller must hold channel lock
+// Start a note of indefinite duration from the next rendered sample, replacing any note playing
+// A volume of 255 keeps the channel's volume
+void AudioChannel::_triggerNote(uint8_t volume, uint16_t frequency) {
+	if (!this->_waveform) {
+		return;
+	}
+	if (volume == 255) {
+		volume = this->_volume;
 	}
-	switch (this->_state) {
+	volume = std::min(volume, (uint8_t)127);
+	this->_volume = volume;
+	this->_frequency = frequency;
+	_postNote(volume, frequency, -1);
+	// as in setVolume, a state change the VDU side has made since we looked takes priority
+	auto state = this->_state.load();
+	this->_state.compare_exchange_strong(state, AudioState::Pending);
+}
+
+uint8_t AudioChannel::getStatus() {
+	uint8_t status = this->_status;
+	switch (this->_state.load()) {
 		case AudioState::Pending:
+			// the mixer hasn't started this note yet
+			status |= AUDIO_STATUS_PLAYING;
+			break;
+		case AudioState::Idle:
+		case AudioState::Abort:
+			// stopped, or about to be
+			status = 0;
+			break;
 		case AudioState::Playing:
 		case AudioState::PlayLoop:
-			status |= AUDIO_STATUS_PLAYING;
+		case AudioState::Release:
+			// the mixer's status is up to date
 			break;
 	}
 	if (this->_volumeEnvelope) {
@@ -188,25 +293,44 @@ WaveformGenerator *AudioChannel::getSampleWaveform(uint16_t sampleId, AudioChann
 	return nullptr;
 }
 
+WaveformGenerator *AudioChannel::getWavetableWaveform(uint16_t bufferId) {
+	if (buffers.find(bufferId) == buffers.end()) {
+		debug_log("wavetable buffer %d not found\n\r", bufferId);
+		return nullptr;
+	}
+	// copy out the tables, so the buffer can change without affecting playback
+	std::vector<int8_t> data;
+	for (auto &block : buffers[bufferId]) {
+		data.insert(data.end(), (int8_t *)block->getBuffer(), (int8_t *)block->getBuffer() + block->size());
+	}
+	if (data.size() < WAVETABLE_SIZE) {
+		debug_log("wavetable buffer %d too short (%d bytes)\n\r", bufferId, data.size());
+		return nullptr;
+	}
+	auto waveform = new WavetableBlockGenerator(data.data(), data.size() >= WAVETABLE_SIZE * 2);
+	waveform->setMorph(this->_morph);
+	return waveform;
+}
+
 uint8_t AudioChannel::setWaveform(int8_t waveformType, uint16_t sampleId) {
 	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	WaveformGenerator *newWaveform = nullptr;
 
 	switch (waveformType) {
 		case AUDIO_WAVE_SAWTOOTH:
-			newWaveform = new SawtoothWaveformGenerator();
+			newWaveform = new SawtoothBlockGenerator();
 			break;
 		case AUDIO_WAVE_SQUARE:
-			newWaveform = new SquareWaveformGenerator();
+			newWaveform = new SquareBlockGenerator();
 			break;
 		case AUDIO_WAVE_SINE:
-			newWaveform = new SineWaveformGenerator();
+			newWaveform = new SineBlockGenerator();
 			break;
 		case AUDIO_WAVE_TRIANGLE:
-			newWaveform = new TriangleWaveformGenerator();
+			newWaveform = new TriangleBlockGenerator();
 			break;
 		case AUDIO_WAVE_NOISE:
-			newWaveform = new NoiseWaveformGenerator();
+			newWaveform = new NoiseBlockGenerator();
 			break;
 		case AUDIO_WAVE_VICNOISE:
 			newWaveform = new VICNoiseGenerator();
@@ -216,6 +340,10 @@ uint8_t AudioChannel::setWaveform(int8_t waveformType, uint16_t sampleId) {
 			debug_log("AudioChannel: using sample buffer %d for waveform on channel %d\n\r", sampleId, channel());
 			newWaveform = getSampleWaveform(sampleId, this);
 			break;
+		case AUDIO_WAVE_WAVETABLE:
+			debug_log("AudioChannel: using wavetable buffer %d for waveform on channel %d\n\r", sampleId, channel());
+			newWaveform = getWavetableWaveform(sampleId);
+			break;
 		default:
 			// negative values indicate a sample number
 			if (waveformType < 0) {
@@ -252,7 +380,6 @@ uint8_t AudioChannel::setWaveform(int8_t waveformType, uint16_t sampleId) {
 }
 
 uint8_t AudioChannel::setVolume(uint8_t volume) {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	debug_log("AudioChannel: setVolume %d on channel %d\n\r", volume, channel());
 	if (volume == 255) {
 		return this->_volume;
@@ -262,41 +389,42 @@ uint8_t AudioChannel::setVolume(uint8_t volume) {
 	}
 
 	if (this->_waveform) {
-		switch (this->_state) {
+		auto state = this->_state.load();
+		switch (state) {
 			case AudioState::Idle:
 				if (volume > 0) {
-					// new note playback
+					// new note playback, of indefinite duration
 					this->_volume = volume;
-					this->_duration = -1;	// indefinite duration
-					this->_state = AudioState::Pending;
+					this->_duration = -1;
+					_postNote(volume, this->_frequency, -1);
+					this->_state.compare_exchange_strong(state, AudioState::Pending);
 				}
 				break;
 			case AudioState::PlayLoop:
 				// we are looping, so an envelope may be active
 				if (volume == 0 && this->_waveformType != AUDIO_WAVE_SAMPLE) {
-					// silence whilst looping always stops playback - curtail duration
-					this->_duration = millis() - this->_startTime;
-					// if there's a volume envelope, just allow release to happen, otherwise...
-					if (!this->_volumeEnvelope) {
-						this->_volume = 0;
-					}
+					// silence whilst looping always stops playback - mixer will curtail duration
+					this->_changes |= AUDIO_CHANGE_CURTAIL;
 				} else {
-					// Change base volume level, so next loop iteration will use it
+					// Change base volume level, so next block will use it
 					this->_volume = volume;
 				}
 				break;
 			case AudioState::Pending:
+				this->_noteVolume = volume;
+				this->_volume = volume;
+				break;
 			case AudioState::Release:
-				// Set level so next loop will pick up the new volume
+				// Set level so next block will pick up the new volume
 				this->_volume = volume;
 				break;
 			default:
-				// All other states we'll set volume immediately
+				// All other states the mixer sets volume at its next block
 				this->_volume = volume;
-				this->_waveform->setVolume(volume);
+				this->_changes |= AUDIO_CHANGE_VOLUME;
 				if (volume == 0 && this->_waveformType != AUDIO_WAVE_SAMPLE) {
 					// we're going silent, so abort any current playback
-					this->_goIdle();
+					this->_state.compare_exchange_strong(state, AudioState::Abort);
 				}
 				break;
 		}
@@ -306,41 +434,36 @@ uint8_t AudioChannel::setVolume(uint8_t volume) {
 }
 
 uint8_t AudioChannel::setFrequency(uint16_t frequency) {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	debug_log("AudioChannel: setFrequency %d on channel %d\n\r", frequency, channel());
 	this->_frequency = frequency;
+	this->_noteFrequency = frequency;
 
 	if (this->_waveform) {
-		switch (this->_state) {
-			case AudioState::Pending:
-			case AudioState::PlayLoop:
-			case AudioState::Release:
-				// Do nothing as next loop will pick up the new frequency
-				break;
-			default:
-				this->_waveform->setFrequency(frequency);
-		}
+		// a playing note picks this up at the next block, and envelopes work from _frequency
+		this->_changes |= AUDIO_CHANGE_FREQUENCY;
 		return 1;
 	}
 	return 0;
 }
 
 uint8_t AudioChannel::setDuration(int32_t duration) {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	debug_log("AudioChannel: setDuration %d on channel %d\n\r", duration, channel());
 	if (duration == 0xFFFFFF) {
 		duration = -1;
 	}
 	this->_duration = duration;
+	this->_noteDuration = duration;
 
 	if (this->_waveform) {
-		switch (this->_state) {
+		auto state = this->_state.load();
+		switch (state) {
 			case AudioState::Idle:
 				// kick off a new note playback
-				this->_state = AudioState::Pending;
+				_postNote(this->_volume, this->_frequency, duration);
+				this->_state.compare_exchange_strong(state, AudioState::Pending);
 				break;
 			case AudioState::Playing:
-				this->_goIdle();
+				this->_state.compare_exchange_strong(state, AudioState::Abort);
 				break;
 			default:
 				// any other state we should be looping so it will just get picked up
@@ -383,16 +506,24 @@ uint8_t AudioChannel::setSampleRate(uint16_t sampleRate) {
 }
 
 uint8_t AudioChannel::setDutyCycle(uint8_t dutyCycle) {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	if (this->_waveform && this->_waveformType == AUDIO_WAVE_SQUARE) {
-		((SquareWaveformGenerator *)&*_waveform)->setDutyCycle(dutyCycle);
+		this->_dutyCycle = dutyCycle;
+		this->_changes |= AUDIO_CHANGE_DUTY_CYCLE;
+		return 1;
+	}
+	return 0;
+}
+
+uint8_t AudioChannel::setMorph(uint8_t morph) {
+	this->_morph = morph;
+	if (this->_waveform && this->_waveformType == AUDIO_WAVE_WAVETABLE) {
+		this->_changes |= AUDIO_CHANGE_MORPH;
 		return 1;
 	}
 	return 0;
 }
 
 uint8_t AudioChannel::setParameter(uint8_t parameter, uint16_t value) {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
 	if (this->_waveform) {
 		bool use16Bit = parameter & AUDIO_PARAM_16BIT;
 		auto param = parameter & AUDIO_PARAM_MASK;
@@ -405,29 +536,38 @@ uint8_t AudioChannel::setParameter(uint8_t parameter, uint16_t value) {
 			}	break;
 			case AUDIO_PARAM_FREQUENCY: {
 				if (!use16Bit) {
-					value = _frequency & 0xFF00 | value & 0x00FF;
+					value = (_frequency & 0xFF00) | (value & 0x00FF);
 				}
 				return setFrequency(value);
 			}	break;
+			case AUDIO_PARAM_INTERPOLATION: {
+				if (this->_waveformType == AUDIO_WAVE_SAMPLE) {
+					auto lock = std::unique_lock<std::mutex>(_channelMutex);
+					((EnhancedSamplesGenerator *)&*_waveform)->setInterpolation(value);
+					return 1;
+				}
+			}	break;
+			case AUDIO_PARAM_MORPH: {
+				return setMorph(value);
+			}	break;
 		}
 	}
 	return 0;
 }
 
 // caller must hold channel lock
+// the mixer also takes the channel lock to render, so the waveform can't be in use
 void AudioChannel::attachSoundGenerator() {
 	if (this->_waveform) {
-		auto lock = std::unique_lock<std::mutex>(soundGeneratorMutex);
-		soundGenerator->attach(&*_waveform);
+		this->_waveform->setSampleRate(audioMixer.sampleRate());
+		// all our waveforms other than VIC noise can render a block at a time
+		this->_blockWaveform = this->_waveformType == AUDIO_WAVE_VICNOISE ? nullptr : (BlockWaveformGenerator *)&*_waveform;
 	}
 }
 
 // caller must hold channel lock
 void AudioChannel::detachSoundGenerator() {
-	if (this->_waveform) {
-		auto lock = std::unique_lock<std::mutex>(soundGeneratorMutex);
-		soundGenerator->detach(&*_waveform);
-	}
+	this->_blockWaveform = nullptr;
 	this->_state = AudioState::Idle;
 }
 
@@ -469,7 +609,7 @@ bool AudioChannel::_isReleasing(uint32_t elapsed) {
 	if (this->_duration == -1) {
 		return false;
 	}
-	return elapsed >= this->_duration;
+	return elapsed >= (uint32_t)this->_duration;
 }
 
 // caller must hold channel lock
@@ -480,88 +620,266 @@ bool AudioChannel::_isFinished(uint32_t elapsed) {
 	if (this->_duration == -1) {
 		return false;
 	}
-	return (elapsed >= this->_duration);
+	return (elapsed >= (uint32_t)this->_duration);
 }
 
-void AudioChannel::loop(uint64_t now) {
-	auto lock = std::unique_lock<std::mutex>(_channelMutex);
+// caller must hold channel lock
+// Time of the next point after elapsed at which our frequency or state may change
+// Volume envelopes are followed by _followVolume
+uint32_t AudioChannel::_getNextChange(uint32_t elapsed) {
+	uint32_t next = UINT32_MAX;
+	if (this->_duration >= 0 && elapsed < (uint32_t)this->_duration) {
+		// release starts at the end of the duration
+		next = this->_duration;
+	}
+	if (this->_frequencyEnvelope) {
+		next = std::min(next, this->_frequencyEnvelope->getNextChange(elapsed, this->_duration));
+	}
+	return next;
+}
 
-	switch (this->_state) {
-		case AudioState::Pending:
-			debug_log("AudioChannel: play %d,%d,%d,%d\n\r", channel(), this->_volume, this->_frequency, this->_duration);
+// caller must hold channel lock
+// Milliseconds since the note started, at a time on the mixer clock
+uint32_t AudioChannel::_elapsed(uint64_t now) {
+	return (now - this->_startTime) * 1000 / audioMixer.sampleRate();
+}
+
+// caller must hold channel lock
+// Set our volume from the volume envelope's current ramp at a time on the mixer clock
+// Returns how many samples until the volume next steps, so a ramp wakes the channel only when its level changes
+uint32_t AudioChannel::_followVolume(uint32_t elapsed, uint64_t now) {
+	auto ramp = this->_volumeEnvelope->getRamp(this->_volume, elapsed, this->_duration);
+	if (ramp.end == UINT32_MAX) {
+		this->_waveform->setVolume(ramp.startVolume);
+		return UINT32_MAX;
+	}
+	uint64_t start = _sampleAt(ramp.start);
+	uint64_t end = _sampleAt(ramp.end);
+	int delta = ramp.endVolume - ramp.startVolume;
+	if (delta == 0 || end <= start || now < start) {
+		this->_waveform->setVolume(ramp.startVolume);
+		return end > now ? std::min(end - now, (uint64_t)UINT32_MAX) : 1;
+	}
+	// the level is stepped at the sample it would reach on the line, rounding towards the start volume
+	uint64_t length = end - start;
+	uint64_t steps = std::abs(delta);
+	uint64_t step = (now - start) * steps / length;
+	this->_waveform->setVolume(ramp.startVolume + (delta < 0 ? -(int)step : (int)step));
+	uint64_t next = std::min(start + ((step + 1) * length + steps - 1) / steps, end);
+	return next > now ? std::min(next - now, (uint64_t)UINT32_MAX) : 1;
+}
+
+// caller must hold channel lock
+// Sample on the mixer clock at a time in milliseconds since the note started
+// Rounds up, so the elapsed time has reached time by the returned sample
+uint64_t AudioChannel::_sampleAt(uint32_t time) {
+	return this->_startTime + ((uint64_t)time * audioMixer.sampleRate() + 999) / 1000;
+}
+
+// caller must hold channel lock
+// Samples from now until a time (in milliseconds since the note started), which is at least one sample
+uint32_t AudioChannel::_samplesUntil(uint32_t time, uint64_t now) {
+	if (time == UINT32_MAX) {
+		return UINT32_MAX;
+	}
+	uint64_t target = _sampleAt(time);
+	return target > now ? std::min(target - now, (uint64_t)UINT32_MAX) : 1;
+}
+
+// caller must hold channel lock
+// Move to a new state, unless the VDU side has changed our state since it was read
+bool AudioChannel::_setState(AudioState from, AudioState to) {
+	return this->_state.compare_exchange_strong(from, to);
+}
+
+// Fill in the next note to play, before moving to Pending
+void AudioChannel::_postNote(uint8_t volume, uint16_t frequency, int32_t duration) {
+	this->_noteVolume = volume;
+	this->_noteFrequency = frequency;
+	this->_noteDuration = duration;
+}
+
+// caller must hold channel lock
+// Apply changes posted by the VDU side
+void AudioChannel::_applyChanges(uint8_t changes, uint64_t now) {
+	if (!this->_waveform) {
+		return;
+	}
+	auto state = this->_state.load();
+	if ((changes & AUDIO_CHANGE_CURTAIL) && state == AudioState::PlayLoop) {
+		this->_duration = _elapsed(now);
+		// if there's a volume envelope, just allow release to happen, otherwise...
+		if (!this->_volumeEnvelope) {
+			this->_volume = 0;
+		}
+	}
+	if (state == AudioState::Playing) {
+		// other states set volume and frequency as they run
+		if (changes & AUDIO_CHANGE_VOLUME) {
+			this->_waveform->setVolume(this->_volume);
+		}
+		if (changes & AUDIO_CHANGE_FREQUENCY) {
+			this->_waveform->setFrequency(this->_frequency);
+		}
+	}
+	if ((changes & AUDIO_CHANGE_DUTY_CYCLE) && this->_waveformType == AUDIO_WAVE_SQUARE) {
+		((SquareBlockGenerator *)&*_waveform)->setDutyCycle(this->_dutyCycle);
+	}
+	if ((changes & AUDIO_CHANGE_MORPH) && this->_waveformType == AUDIO_WAVE_WAVETABLE) {
+		((WavetableBlockGenerator *)&*_waveform)->setMorph(this->_morph);
+	}
+}
+
+// caller must hold channel lock
+// Run our state machine at a time on the mixer clock
+// Returns how many samples can be rendered before it needs to run again
+uint32_t AudioChannel::_update(uint64_t now) {
+	if (!this->_waveform) {
+		return UINT32_MAX;
+	}
+
+	switch (this->_state.load()) {
+		case AudioState::Pending: {
 			// we have a new note to play
+			this->_volume = this->_noteVolume.load();
+			this->_frequency = this->_noteFrequency.load();
+			this->_duration = this->_noteDuration.load();
+			debug_log("AudioChannel: play %d,%d,%d,%d\n\r", channel(), this->_volume.load(), this->_frequency.load(), this->_duration.load());
 			this->_startTime = now;
 			// set our initial volume and frequency
 			this->_waveform->setVolume(this->_getVolume(0));
 			this->_seekTo(0);
 			this->_waveform->setFrequency(this->_getFrequency(0));
 			this->_waveform->enable(true);
-			// if we have an envelope then we loop, otherwise just delay for duration
-			if (this->_volumeEnvelope || this->_frequencyEnvelope) {
-				this->_state = AudioState::PlayLoop;
-			} else {
-				this->_state = AudioState::Playing;
-			}
-			break;
+			// if we have an envelope then we loop, otherwise just play for duration
+			bool loop = this->_volumeEnvelope || this->_frequencyEnvelope;
+			_setState(AudioState::Pending, loop ? AudioState::PlayLoop : AudioState::Playing);
+			return _update(now);
+		}
 
 		case AudioState::Playing:
 			if (this->_duration >= 0) {
-				// simple playback - delay until we have reached our duration
-				uint32_t elapsed = now - this->_startTime;
-				//debug_log("AudioChannel: %d elapsed %d\n\r", channel(), elapsed);
-				if (elapsed >= this->_duration) {
+				// simple playback - stop on the sample where we reach our duration
+				if (_elapsed(now) >= (uint32_t)this->_duration) {
 					this->_waveform->enable(false);
-					//debug_log("AudioChannel: %d end\n\r", channel());
-					this->_state = AudioState::Idle;
-				} else {
-					//debug_log("AudioChannel: %d loop (%d)\n\r", channel(), this->_duration - elapsed);
+					return _setState(AudioState::Playing, AudioState::Idle) ? UINT32_MAX : _update(now);
 				}
-			} else {
-				// our duration is indefinite, so delay for a long time
-				//debug_log("AudioChannel: %d loop (indefinite playback)\n\r", channel());
+				return _samplesUntil(this->_duration, now);
 			}
-			break;
+			// our duration is indefinite
+			return UINT32_MAX;
 
 		// loop and release states used for envelopes
 		case AudioState::PlayLoop: {
-			uint32_t elapsed = now - this->_startTime;
+			auto elapsed = _elapsed(now);
 			if (_isReleasing(elapsed)) {
 				debug_log("AudioChannel: releasing %d...\n\r", channel());
-				this->_state = AudioState::Release;
+				if (!_setState(AudioState::PlayLoop, AudioState::Release)) {
+					return _update(now);
+				}
 			}
 			// update volume and frequency as appropriate
+			uint32_t next = _samplesUntil(_getNextChange(elapsed), now);
 			if (this->_volumeEnvelope)
-				this->_waveform->setVolume(this->_getVolume(elapsed));
+				next = std::min(next, _followVolume(elapsed, now));
 			if (this->_frequencyEnvelope)
 				this->_waveform->setFrequency(this->_getFrequency(elapsed));
-			break;
+			return next;
 		}
 
 		case AudioState::Release: {
-			uint32_t elapsed = now - this->_startTime;
+			auto elapsed = _elapsed(now);
 			// update volume and frequency as appropriate
+			uint32_t next = _samplesUntil(_getNextChange(elapsed), now);
 			if (this->_volumeEnvelope)
-				this->_waveform->setVolume(this->_getVolume(elapsed));
+				next = std::min(next, _followVolume(elapsed, now));
 			if (this->_frequencyEnvelope)
 				this->_waveform->setFrequency(this->_getFrequency(elapsed));
 
 			if (_isFinished(elapsed)) {
 				this->_waveform->enable(false);
 				debug_log("AudioChannel: end (released %d)\n\r", channel());
-				this->_state = AudioState::Idle;
+				return _setState(AudioState::Release, AudioState::Idle) ? UINT32_MAX : _update(now);
 			}
-			break;
+			return next;
 		}
 
 		case AudioState::Abort:
 			this->_waveform->enable(false);
 			debug_log("AudioChannel: abort %d\n\r", channel());
-			this->_state = AudioState::Idle;
+			return _setState(AudioState::Abort, AudioState::Idle) ? UINT32_MAX : _update(now);
+
+		case AudioState::Idle:
 			break;
+	}
+	return UINT32_MAX;
+}
+
+// Render a block of samples for the mixer, starting at a time on the mixer clock
+// The state machine runs at each point in the block where our volume, frequency or state may change,
+// so notes start and stop on the exact sample, and steady sounds render in one go
+// Returns true if any samples were produced, with the waveform's volume in volume
+bool AudioChannel::render(int16_t * buffer, int count, uint64_t now, int & volume) {
+	// the audio task mustn't wait on the VDU side, so a channel that's being changed is silent for this block
+	auto lock = std::unique_lock<std::mutex>(_channelMutex, std::try_to_lock);
+	volume = 0;
+	if (!lock.owns_lock()) {
+		memset(buffer, 0, count * sizeof(int16_t));
+		return false;
+	}
+	auto event = this->_rowEvent.exchange(AUDIO_NO_ROW_EVENT);
+	if (event != AUDIO_NO_ROW_EVENT) {
+		_playRowEvent(event);
+	}
+	auto changes = this->_changes.exchange(0);
+	if (changes) {
+		_applyChanges(changes, now);
+	}
 
+	bool active = false;
+	int position = 0;
+	while (position < count) {
+		int length = std::min(_update(now + position), (uint32_t)(count - position));
+		if (this->_waveform && this->_waveform->enabled()) {
+			if (this->_blockWaveform) {
+				this->_blockWaveform->renderBlock(buffer + position, length);
+			} else {
+				for (int i = 0; i < length; i++) {
+					buffer[position + i] = this->_waveform->getSample();
+				}
+			}
+			volume = std::max(volume, this->_waveform->volume());
+			active = true;
+		} else {
+			memset(buffer + position, 0, length * sizeof(int16_t));
+		}
+		position += length;
+	}
+
+	// publish our status for getStatus
+	uint8_t status = 0;
+	if (this->_waveform && this->_waveform->enabled()) {
+		status |= AUDIO_STATUS_ACTIVE;
+		if (this->_duration == -1) {
+			status |= AUDIO_STATUS_INDEFINITE;
+		}
+		if (this->_waveformType == AUDIO_WAVE_SAMPLE && ((EnhancedSamplesGenerator *)&*_waveform)->isStreamLow()) {
+			status |= AUDIO_STATUS_STREAM_LOW;
+		}
+	}
+	switch (this->_state.load()) {
+		case AudioState::Pending:
+		case AudioState::Playing:
+		case AudioState::PlayLoop:
+			status |= AUDIO_STATUS_PLAYING;
+			break;
 		case AudioState::Idle:
+		case AudioState::Release:
+		case AudioState::Abort:
 			break;
 	}
+	this->_status = status;
+	return active;
 }
 
 #endif // AUDIO_CHANNEL_H
@@ -0,0 +1,141 @@
+#ifndef AUDIO_MIXER_H
+#define AUDIO_MIXER_H
+
+// Audio mixer
+// The mixer is the only generator attached to fabgl's sound generator.  It renders every channel
+// a block at a time into a scratch buffer, sums the blocks in 32 bits, and then scales and clamps
+// the mix once per sample.  fabgl then reads the mix back one sample at a time.
+//
+// The mixer counts the samples it has mixed, and that count is the clock for all channels.  Each
+// channel runs its own note state and envelopes as it renders, so timing follows the audio output
+// exactly, and nothing needs to poll the channels.
+//
+// The mixer also runs the sequencer, splitting blocks where its rows fall
+//
+// This is included by audio_channel.h, after the AudioChannel class is declared
+//
+
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+#include <fabgl.h>
+
+#include "agon.h"
+#include "audio_sequencer.h"
+#include "types.h"
+
+// Samples rendered per channel at a time
+// A build with this set to 1 renders a sample at a time, as fabgl's sound generator did, for comparison
+#ifndef AUDIO_BLOCK_SIZE
+#define AUDIO_BLOCK_SIZE	64
+#endif
+
+extern std::mutex soundGeneratorMutex;
+
+class AudioMixer : public WaveformGenerator {
+	public:
+		AudioMixer() : sequencer(channels) {
+			setVolume(127);
+			enable(true);
+		}
+
+		void setFrequency(int value) {}
+
+		int getSample() {
+			if (position == AUDIO_BLOCK_SIZE) {
+				renderBlock();
+				position = 0;
+			}
+			return output[position++];
+		}
+
+		// Fill buffer with the next count mixed samples, as a sequence of getSample() calls would
+		// This lets the mix be rendered without fabgl's sound generator, such as to a file
+		// The mixer is silent until it has a sample rate, which attaching it to a sound generator sets,
+		// so call setSampleRate first when there isn't one
+		void render(int8_t * buffer, int count) {
+			while (count > 0) {
+				if (position == AUDIO_BLOCK_SIZE) {
+					renderBlock();
+					position = 0;
+				}
+				int length = std::min(count, AUDIO_BLOCK_SIZE - position);
+				memcpy(buffer, output + position, length);
+				position += length;
+				buffer += length;
+				count -= length;
+			}
+		}
+
+		void addChannel(uint8_t channel, AudioChannel * audioChannel) {
+			auto lock = std::unique_lock<std::mutex>(soundGeneratorMutex);
+			channels[channel] = audioChannel;
+		}
+
+		// Once this returns the channel is no longer being rendered
+		void removeChannel(uint8_t channel) {
+			auto lock = std::unique_lock<std::mutex>(soundGeneratorMutex);
+			channels[channel] = nullptr;
+		}
+
+	private:
+		// the sequencer is given the channels when it's constructed, so they're declared first
+		AudioChannel *	channels[MAX_AUDIO_CHANNELS] = { nullptr };
+
+	public:
+		AudioSequencer	sequencer;
+
+	private:
+		void renderBlock();
+
+		uint64_t	clock = 0;				// Samples mixed so far
+		int32_t		mix[AUDIO_BLOCK_SIZE];
+		int16_t		scratch[AUDIO_BLOCK_SIZE];
+		int8_t		output[AUDIO_BLOCK_SIZE];
+		uint8_t		position = AUDIO_BLOCK_SIZE;
+};
+
+AudioMixer		audioMixer;			// Mixes all audio channels for the sound generator
+
+void AudioMixer::renderBlock() {
+	memset(mix, 0, sizeof(mix));
+	int totalVolume = 0;
+	// the sound generator is being replaced if we can't get the lock, so just output silence
+	// as we do until one has given us a sample rate, as channel times and sequencer rows are worked out from it
+	auto lock = std::unique_lock<std::mutex>(soundGeneratorMutex, std::try_to_lock);
+	if (lock.owns_lock() && sampleRate() > 0) {
+		sequencer.update();
+		int position = 0;
+		while (position < AUDIO_BLOCK_SIZE) {
+			// render up to the next sequencer row, so its notes start on the right sample
+			int count = std::min((uint32_t)(AUDIO_BLOCK_SIZE - position), sequencer.samplesUntilRow());
+			if (count == 0) {
+				sequencer.playRow(sampleRate());
+				continue;
+			}
+			int segmentVolume = 0;
+			for (int channel = 0; channel < MAX_AUDIO_CHANNELS; channel++) {
+				int volume;
+				if (!channels[channel] || !channels[channel]->render(scratch, count, clock + position, volume)) {
+					continue;
+				}
+				for (int i = 0; i < count; i++) {
+					mix[position + i] += scratch[i];
+				}
+				segmentVolume += volume;
+			}
+			totalVolume = std::max(totalVolume, segmentVolume);
+			sequencer.advance(count);
+			position += count;
+		}
+	}
+	clock += AUDIO_BLOCK_SIZE;
+
+	// as fabgl does, scale down the mix when the channel volumes add up to more than full volume
+	int scale = totalVolume ? std::min(127, 127 * 127 / totalVolume) : 127;
+	for (int i = 0; i < AUDIO_BLOCK_SIZE; i++) {
+		output[i] = std::min(std::max(mix[i] * scale / 127, (int32_t)-128), (int32_t)127);
+	}
+}
+
+#endif // AUDIO_MIXER_H
@@ -1,21 +1,56 @@
 #ifndef AUDIO_SAMPLE_H
 #define AUDIO_SAMPLE_H
 
+#include <algorithm>
+#include <atomic>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 #include "types.h"
 #include "audio_channel.h"
 #include "buffer_stream.h"
 
+#define ADPCM_SAMPLES_PER_BLOCK	((AUDIO_ADPCM_BLOCK_SIZE - 4) * 2 + 1)
+#define AUDIO_STREAM_BLOCKS			16	// Blocks a streaming sample can hold waiting to be played
+#define AUDIO_STREAM_LOW_WATERMARK	4	// Fewer blocks than this waiting sets AUDIO_STATUS_STREAM_LOW
+
+// Position within a sample's data
+// Holds a raw pointer to the current block, so reading a sample needs no reference counting
+// and only touches the block table when crossing into the next block
+// ADPCM samples also keep their decoder state here, which is reset from each ADPCM block's header
+struct SampleCursor {
+	const uint8_t *	data = nullptr;		// Current block's data
+	uint32_t		length = 0;			// Current block's length
+	uint32_t		index = 0;			// Current index inside the current block
+	uint32_t		blockIndex = 0;		// Current index into the sample data blocks
+	int32_t			predictor = 0;		// ADPCM decoder's last sample
+	uint8_t			stepIndex = 0;		// ADPCM decoder's step size index
+	uint8_t			codes = 0;			// ADPCM byte being decoded
+	bool			highNibble = false;	// Next ADPCM code is the top half of codes
+	uint16_t		adpcmOffset = 0;	// Bytes read from the current ADPCM block
+};
+
+// A sample is either a fixed list of blocks, or a stream
+// Streams keep their blocks in a ring, which the VDU side appends to as data is written to the
+// stream's buffer, and the mixer plays through.  Played blocks are released by the VDU side as it
+// appends, so a stream can play for as long as data keeps coming without holding all of it.
+// If the mixer catches up with the data it plays silence, and counts an underrun.
+//
 struct AudioSample {
-	AudioSample(std::vector<std::shared_ptr<BufferStream>> streams, uint8_t format, uint32_t sampleRate = AUDIO_DEFAULT_SAMPLE_RATE, uint16_t frequency = 0) :
-		blocks(streams), format(format), sampleRate(sampleRate), baseFrequency(frequency) {}
+	AudioSample(std::vector<std::shared_ptr<BufferStream>> streams, uint8_t format, uint32_t sampleRate = AUDIO_DEFAULT_SAMPLE_RATE, uint16_t frequency = 0, bool stream = false);
 	~AudioSample();
 
-	int8_t getSample(uint32_t & index, uint32_t & blockIndex);
-	void seekTo(uint32_t position, uint32_t & index, uint32_t & blockIndex, int32_t & repeatCount);
-	uint32_t getSize();
+	// Samples are returned scaled to 16 bits, whatever the format
+	// Playback picks the format once and reads through the template, so there's no per-sample format check
+	template<uint8_t Format> inline int16_t getSample(SampleCursor & cursor);
+	void seekTo(uint32_t position, SampleCursor & cursor, int32_t & repeatCount);
+	uint32_t getSize() { return size; }
+
+	bool isStream() { return stream; }
+	bool append(std::shared_ptr<BufferStream> block);
+	bool isStreamLow() { return stream && written - played < AUDIO_STREAM_LOW_WATERMARK; }
+	uint32_t getUnderruns() { return underruns; }
 
 	std::vector<std::shared_ptr<BufferStream>> blocks;
 	uint8_t			format;				// Format of the sample data
@@ -24,8 +59,67 @@ struct AudioSample {
 	int32_t			repeatStart = 0;	// Start offset for repeat, in samples
 	int32_t			repeatLength = -1;	// Length of the repeat section in samples, -1 means to end of sample
 	// std::unordered_map<uint8_t, std::weak_ptr<AudioChannel>> channels;	// Channels playing this sample
+
+	private:
+		struct Block {
+			const uint8_t *	data;
+			uint32_t		length;
+		};
+		std::vector<Block>	blockTable;		// Data pointer and length of each block, taken from blocks
+		uint32_t		size = 0;			// Total number of samples
+		uint8_t			signFlip;			// XORed with each byte to give a signed sample
+
+		// streams use blocks and blockTable as a ring, indexed by block number modulo AUDIO_STREAM_BLOCKS
+		bool			stream;
+		std::atomic<uint32_t>	written;	// Blocks appended by the VDU side
+		std::atomic<uint32_t>	played;		// Blocks the mixer has finished with
+		uint32_t		released = 0;		// Played blocks the VDU side has let go of
+		std::atomic<uint32_t>	underruns;	// Times the mixer has run out of data
+		bool			starved = false;	// Mixer is waiting for data
+
+		void setBlock(SampleCursor & cursor, uint32_t blockIndex);
+		inline uint8_t readByte(SampleCursor & cursor);
+		int16_t getADPCMSample(SampleCursor & cursor);
 };
 
+AudioSample::AudioSample(std::vector<std::shared_ptr<BufferStream>> streams, uint8_t format, uint32_t sampleRate, uint16_t frequency, bool stream) :
+	blocks(streams), format(format), sampleRate(sampleRate), baseFrequency(frequency), stream(stream), written(0), played(0), underruns(0)
+{
+	// unsigned samples are converted to signed by flipping the top bit
+	signFlip = format == AUDIO_FORMAT_8BIT_UNSIGNED ? 0x80 : 0x00;
+	if (stream) {
+		// size is unknown, so playing a stream needs an explicit duration
+		blocks.clear();
+		blocks.resize(AUDIO_STREAM_BLOCKS);
+		blockTable.resize(AUDIO_STREAM_BLOCKS, { nullptr, 0 });
+		for (auto &block : streams) {
+			append(block);
+		}
+		return;
+	}
+
+	// blocks keeps the streams alive, so their data pointers stay valid for the life of the sample
+	blockTable.reserve(blocks.size());
+	uint32_t bytes = 0;
+	for (auto &block : blocks) {
+		blockTable.push_back({ block->getBuffer(), block->size() });
+		bytes += block->size();
+	}
+	switch (format) {
+		case AUDIO_FORMAT_16BIT_SIGNED:
+			size = bytes / 2;
+			break;
+		case AUDIO_FORMAT_ADPCM: {
+			// a partial block at the end still has its header sample, and two samples per byte after that
+			auto remainder = bytes % AUDIO_ADPCM_BLOCK_SIZE;
+			size = (bytes / AUDIO_ADPCM_BLOCK_SIZE) * ADPCM_SAMPLES_PER_BLOCK + (remainder >= 4 ? (remainder - 4) * 2 + 1 : 0);
+		}	break;
+		default:
+			size = bytes;
+			break;
+	}
+}
+
 AudioSample::~AudioSample() {
 	// iterate over channels
 	// for (auto &channelPair : this->channels) {
@@ -39,30 +133,158 @@ AudioSample::~AudioSample() {
 	// }
 }
 
-int8_t AudioSample::getSample(uint32_t & index, uint32_t & blockIndex) {
-	// get the next sample
-	if (blockIndex >= blocks.size()) {
-		// we've reached the end of the sample, and haven't looped, so return 0 (silence)
+// Point a cursor at the start of a block, skipping over any empty blocks
+//
+void AudioSample::setBlock(SampleCursor & cursor, uint32_t blockIndex) {
+	if (stream) {
+		// blocks before this one have been played
+		played = blockIndex;
+		cursor.blockIndex = blockIndex;
+		cursor.data = nullptr;
+		cursor.length = 0;
+		if (blockIndex < written) {
+			auto &block = blockTable[blockIndex % AUDIO_STREAM_BLOCKS];
+			if (block.length == 0) {
+				setBlock(cursor, blockIndex + 1);
+				return;
+			}
+			cursor.data = block.data;
+			cursor.length = block.length;
+		}
+		return;
+	}
+	while (blockIndex < blockTable.size() && blockTable[blockIndex].length == 0) {
+		blockIndex++;
+	}
+	cursor.blockIndex = blockIndex;
+	if (blockIndex < blockTable.size()) {
+		cursor.data = blockTable[blockIndex].data;
+		cursor.length = blockTable[blockIndex].length;
+	} else {
+		cursor.data = nullptr;
+		cursor.length = 0;
+	}
+}
+
+// Read the next byte of sample data, or 0 at the end of the sample
+inline uint8_t AudioSample::readByte(SampleCursor & cursor) {
+	if (!cursor.data) {
 		return 0;
 	}
 
-	auto block = blocks[blockIndex];
-	int8_t sample = block->getBuffer()[index++];
+	uint8_t value = cursor.data[cursor.index++];
 
-	if (index >= block->size()) {
+	if (cursor.index >= cursor.length) {
 		// block reached end, move to next block
-		index = 0;
-		blockIndex++;
+		cursor.index = 0;
+		setBlock(cursor, cursor.blockIndex + 1);
 	}
 
-	if (format == AUDIO_FORMAT_8BIT_UNSIGNED) {
-		sample = sample - 128;
+	return value;
+}
+
+// Read the next sample, with Format as the sample's data format
+// 8-bit unsigned samples are read as 8-bit signed, as signFlip converts them
+//
+template<uint8_t Format> inline int16_t AudioSample::getSample(SampleCursor & cursor) {
+	// get the next sample
+	if (!cursor.data && !cursor.highNibble) {
+		if (stream) {
+			// see if more of the stream has arrived
+			setBlock(cursor, cursor.blockIndex);
+		}
+		if (!cursor.data) {
+			// we've reached the end of the sample, and haven't looped, so return 0 (silence)
+			// (the last ADPCM byte still holds a sample once the data has run out)
+			if (stream && !starved) {
+				underruns++;
+			}
+			starved = stream;
+			return 0;
+		}
+		starved = false;
+	}
+
+	if constexpr (Format == AUDIO_FORMAT_16BIT_SIGNED) {
+		uint8_t low = readByte(cursor);
+		return (int16_t)(low | (readByte(cursor) << 8));
+	} else if constexpr (Format == AUDIO_FORMAT_ADPCM) {
+		return getADPCMSample(cursor);
+	} else {
+		return (int8_t)(readByte(cursor) ^ signFlip) * 256;
+	}
+}
+
+// Decode the next IMA ADPCM sample
+//
+int16_t AudioSample::getADPCMSample(SampleCursor & cursor) {
+	static const int8_t indexTable[16] = {
+		-1, -1, -1, -1, 2, 4, 6, 8,
+		-1, -1, -1, -1, 2, 4, 6, 8
+	};
+	static const int16_t stepTable[89] = {
+		7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+		19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+		50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+		130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+		337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+		876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+		2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+		5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+		15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+	};
+
+	if (cursor.adpcmOffset == 0) {
+		// each block starts with the decoder state, whose predictor is the first sample
+		uint8_t low = readByte(cursor);
+		cursor.predictor = (int16_t)(low | (readByte(cursor) << 8));
+		cursor.stepIndex = std::min(readByte(cursor), (uint8_t)88);
+		readByte(cursor);
+		cursor.adpcmOffset = 4;
+		cursor.highNibble = false;
+		return cursor.predictor;
+	}
+
+	uint8_t code;
+	if (cursor.highNibble) {
+		code = cursor.codes >> 4;
+		cursor.highNibble = false;
+		if (cursor.adpcmOffset == AUDIO_ADPCM_BLOCK_SIZE) {
+			cursor.adpcmOffset = 0;
+		}
+	} else {
+		cursor.codes = readByte(cursor);
+		cursor.adpcmOffset++;
+		code = cursor.codes & 0x0F;
+		cursor.highNibble = true;
 	}
 
-	return sample;
+	int32_t step = stepTable[cursor.stepIndex];
+	int32_t difference = step >> 3;
+	if (code & 4) difference += step;
+	if (code & 2) difference += step >> 1;
+	if (code & 1) difference += step >> 2;
+	cursor.predictor += (code & 8) ? -difference : difference;
+	cursor.predictor = std::min(std::max(cursor.predictor, (int32_t)-32768), (int32_t)32767);
+	cursor.stepIndex = std::min(std::max(cursor.stepIndex + indexTable[code], 0), 88);
+
+	return cursor.predictor;
 }
 
-void AudioSample::seekTo(uint32_t position, uint32_t & index, uint32_t & blockIndex, int32_t & repeatCount) {
+void AudioSample::seekTo(uint32_t position, SampleCursor & cursor, int32_t & repeatCount) {
+	if (stream) {
+		// streams play on from where they have got to, and never repeat
+		repeatCount = 0;
+		if (cursor.blockIndex < played) {
+			// a new cursor, so start at the oldest block that hasn't been played
+			cursor.index = 0;
+			cursor.adpcmOffset = 0;
+			cursor.highNibble = false;
+			setBlock(cursor, played);
+		}
+		return;
+	}
+
 	// NB repeatCount calculation here can result in zero, or a negative number,
 	// or a number that's beyond the end of the sample, which is fine
 	// it just means that the sample will never loop
@@ -76,20 +298,52 @@ void AudioSample::seekTo(uint32_t position, uint32_t & index, uint32_t & blockIn
 		repeatCount = 0;
 	}
 
-	blockIndex = 0;
-	index = position;
-	while (blockIndex < blocks.size() && index >= blocks[blockIndex]->size()) {
-		index -= blocks[blockIndex]->size();
+	// ADPCM can only be decoded from the start of a block, so decode up to the position from there
+	uint32_t offset = position;
+	uint32_t skip = 0;
+	switch (format) {
+		case AUDIO_FORMAT_16BIT_SIGNED:
+			offset = position * 2;
+			break;
+		case AUDIO_FORMAT_ADPCM:
+			offset = (position / ADPCM_SAMPLES_PER_BLOCK) * AUDIO_ADPCM_BLOCK_SIZE;
+			skip = position % ADPCM_SAMPLES_PER_BLOCK;
+			break;
+	}
+
+	uint32_t blockIndex = 0;
+	cursor.index = offset;
+	while (blockIndex < blockTable.size() && cursor.index >= blockTable[blockIndex].length) {
+		cursor.index -= blockTable[blockIndex].length;
 		blockIndex++;
 	}
+	setBlock(cursor, blockIndex);
+	cursor.adpcmOffset = 0;
+	cursor.highNibble = false;
+
+	while (skip--) {
+		getSample<AUDIO_FORMAT_ADPCM>(cursor);
+	}
 }
 
-uint32_t AudioSample::getSize() {
-	uint32_t samples = 0;
-	for (auto block : blocks) {
-		samples += block->size();
+// Add a block to the end of a stream, releasing blocks that have been played
+// Returns false if the stream is full, in which case the block is dropped
+//
+bool AudioSample::append(std::shared_ptr<BufferStream> block) {
+	while (released < played) {
+		blocks[released % AUDIO_STREAM_BLOCKS] = nullptr;
+		released++;
+	}
+	uint32_t index = written;
+	if (index - released >= AUDIO_STREAM_BLOCKS) {
+		debug_log("AudioSample: stream full, dropping %d bytes\n\r", block->size());
+		return false;
 	}
-	return samples;
+	blocks[index % AUDIO_STREAM_BLOCKS] = block;
+	blockTable[index % AUDIO_STREAM_BLOCKS] = { block->getBuffer(), block->size() };
+	// the mixer can only see the block once it's in place
+	written = index + 1;
+	return true;
 }
 
 #endif // AUDIO_SAMPLE_H
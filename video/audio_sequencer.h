@@ -0,0 +1,277 @@
+#ifndef AUDIO_SEQUENCER_H
+#define AUDIO_SEQUENCER_H
+
+// Audio sequencer
+// Plays tracker-style songs on the audio channels, so music doesn't need the eZ80 to time every note.
+// The mixer runs the sequencer, and splits its blocks at row boundaries, so each row's notes start
+// on exactly the sample the row falls on.
+//
+// A song is loaded from a buffer, laid out as:
+//   channels, rows per pattern, tempo (BPM), restart order position (255 to stop at the end),
+//   order length, order list (pattern numbers), then the patterns
+// Each pattern is rows x channels events of 4 bytes:
+//   note, volume, effect, parameter
+// Notes are MIDI note numbers (1-127, A4 = 69), with 0 for no note and AUDIO_SEQUENCER_NOTE_OFF to
+// end the channel's note.  A volume of AUDIO_SEQUENCER_NO_VOLUME leaves the volume as it is.
+// Waveforms can't be changed by a song, as that would need the mixer to allocate a new generator,
+// so set the channels' waveforms up before starting it.
+//
+// Only loading a song waits for the mixer.  Other commands are picked up by the mixer at its next
+// block, and the position and tempo can be read without a lock, so the VDU side never holds up audio.
+//
+// This is included by audio_mixer.h, after the AudioChannel class is declared
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <vector>
+
+#include "agon.h"
+#include "types.h"
+
+#define AUDIO_SEQUENCER_ROWS_PER_BEAT	4		// Rows in each beat of the tempo
+#define AUDIO_SEQUENCER_HEADER_SIZE		5		// Bytes before the order list
+
+#define AUDIO_SEQUENCER_PENDING_START		0x01	// Commands waiting for the mixer
+#define AUDIO_SEQUENCER_PENDING_STOP		0x02
+#define AUDIO_SEQUENCER_PENDING_POSITION	0x04
+
+extern std::mutex soundGeneratorMutex;
+
+class AudioSequencer {
+	public:
+		AudioSequencer(AudioChannel ** channels) : channels(channels), rows(0), orderLength(0), tempo(0), order(0), row(0), pending(0), position(0) {}
+
+		uint8_t load(std::vector<uint8_t> data, uint8_t channel);
+		uint8_t start();
+		uint8_t stop();
+		uint8_t setTempo(uint8_t bpm);
+		uint8_t setPosition(uint8_t order, uint8_t row);
+		uint8_t getOrder();
+		uint8_t getRow();
+
+		// Used by the mixer, which holds soundGeneratorMutex
+		void update();
+		uint32_t samplesUntilRow() { return playing ? rowSamples : UINT32_MAX; }
+		void advance(uint32_t samples) { rowSamples -= std::min(samples, rowSamples); }
+		void playRow(uint32_t sampleRate);
+
+		static uint16_t noteFrequency(uint8_t note);
+
+	private:
+		void silence();
+		const uint8_t * getEvent(uint8_t order, uint8_t row, uint8_t channel);
+
+		AudioChannel **	channels;			// The mixer's channels
+		std::vector<uint8_t>	song;
+		uint8_t		baseChannel = 0;		// Channel the song's first channel plays on
+		uint8_t		channelCount = 0;
+		std::atomic<uint8_t>	rows;		// Rows per pattern
+		uint8_t		restart = 0;			// Order position to go back to after the last
+		std::atomic<uint8_t>	orderLength;
+		std::atomic<uint8_t>	tempo;		// Beats per minute
+		std::atomic<uint8_t>	order;		// Position in the order list
+		std::atomic<uint8_t>	row;		// Next row to play
+		std::atomic<uint8_t>	pending;	// AUDIO_SEQUENCER_PENDING flags waiting for the mixer
+		std::atomic<uint16_t>	position;	// Order position and row for AUDIO_SEQUENCER_PENDING_POSITION
+		bool		playing = false;
+		uint8_t		rowTempo = 0;			// Tempo rowRemainder is counted in
+		uint32_t	rowSamples = 0;			// Samples until the next row plays
+		uint32_t	rowRemainder = 0;		// Fraction of a sample carried between rows, in 1/(tempo * rows per beat)
+};
+
+// Load a song, which plays on channels from channel onwards
+//
+uint8_t AudioSequencer::load(std::vector<uint8_t> data, uint8_t channel) {
+	if (data.size() < AUDIO_SEQUENCER_HEADER_SIZE) {
+		debug_log("AudioSequencer: song too short\n\r");
+		return 0;
+	}
+	auto songChannels = data[0];
+	auto songRows = data[1];
+	auto songOrderLength = data[4];
+	if (songChannels == 0 || channel + songChannels > MAX_AUDIO_CHANNELS || songRows == 0 || data[2] == 0 || songOrderLength == 0) {
+		debug_log("AudioSequencer: invalid song header\n\r");
+		return 0;
+	}
+	size_t orderEnd = AUDIO_SEQUENCER_HEADER_SIZE + songOrderLength;
+	if (data.size() < orderEnd) {
+		debug_log("AudioSequencer: song order list incomplete\n\r");
+		return 0;
+	}
+	size_t patterns = 1 + *std::max_element(data.begin() + AUDIO_SEQUENCER_HEADER_SIZE, data.begin() + orderEnd);
+	if (data.size() < orderEnd + patterns * songRows * songChannels * 4) {
+		debug_log("AudioSequencer: song has %d patterns, but not enough data for them\n\r", (int)patterns);
+		return 0;
+	}
+
+	// the mixer reads the song as it plays, so this is the one command that waits for it
+	auto lock = std::unique_lock<std::mutex>(soundGeneratorMutex);
+	if (playing) {
+		silence();
+	}
+	song = std::move(data);
+	baseChannel = channel;
+	channelCount = songChannels;
+	rows = songRows;
+	tempo = song[2];
+	restart = song[3];
+	orderLength = songOrderLength;
+	order = 0;
+	row = 0;
+	pending = 0;
+	debug_log("AudioSequencer: loaded song with %d channels, %d patterns\n\r", channelCount, (int)patterns);
+	return 1;
+}
+
+// Start playing from the current position, with the first row on the next mixed block
+//
+uint8_t AudioSequencer::start() {
+	if (song.empty()) {
+		return 0;
+	}
+	pending.fetch_and(~AUDIO_SEQUENCER_PENDING_STOP);
+	pending.fetch_or(AUDIO_SEQUENCER_PENDING_START);
+	return 1;
+}
+
+uint8_t AudioSequencer::stop() {
+	pending.fetch_and(~AUDIO_SEQUENCER_PENDING_START);
+	pending.fetch_or(AUDIO_SEQUENCER_PENDING_STOP);
+	return 1;
+}
+
+// A new tempo takes effect from the next row
+//
+uint8_t AudioSequencer::setTempo(uint8_t bpm) {
+	if (bpm == 0) {
+		return 0;
+	}
+	tempo = bpm;
+	return 1;
+}
+
+// The position is checked against the song here, for the reply, and again by the mixer, in case
+// a new song has been loaded in between
+//
+uint8_t AudioSequencer::setPosition(uint8_t newOrder, uint8_t newRow) {
+	if (newOrder >= orderLength || newRow >= rows) {
+		return 0;
+	}
+	position = (newOrder << 8) | newRow;
+	pending.fetch_or(AUDIO_SEQUENCER_PENDING_POSITION);
+	return 1;
+}
+
+uint8_t AudioSequencer::getOrder() {
+	return order;
+}
+
+uint8_t AudioSequencer::getRow() {
+	return row;
+}
+
+// caller must hold soundGeneratorMutex
+// Carry out commands from the VDU side, at the start of a mixed block
+void AudioSequencer::update() {
+	auto commands = pending.exchange(0);
+	if ((commands & AUDIO_SEQUENCER_PENDING_STOP) && playing) {
+		silence();
+	}
+	if (commands & AUDIO_SEQUENCER_PENDING_POSITION) {
+		uint16_t newPosition = position;
+		if ((newPosition >> 8) < orderLength && (newPosition & 0xFF) < rows) {
+			order = newPosition >> 8;
+			row = newPosition & 0xFF;
+		}
+	}
+	if ((commands & AUDIO_SEQUENCER_PENDING_START) && !playing) {
+		rowSamples = 0;
+		rowRemainder = 0;
+		playing = true;
+	}
+}
+
+// caller must hold soundGeneratorMutex
+void AudioSequencer::silence() {
+	playing = false;
+	for (int i = 0; i < channelCount; i++) {
+		if (channels[baseChannel + i]) {
+			channels[baseChannel + i]->goIdle();
+		}
+	}
+}
+
+// caller must hold soundGeneratorMutex
+const uint8_t * AudioSequencer::getEvent(uint8_t order, uint8_t row, uint8_t channel) {
+	auto pattern = song[AUDIO_SEQUENCER_HEADER_SIZE + order];
+	auto offset = AUDIO_SEQUENCER_HEADER_SIZE + orderLength + ((pattern * rows + row) * channelCount + channel) * 4;
+	return &song[offset];
+}
+
+// caller must hold soundGeneratorMutex
+// Play the next row, and work out how long it lasts
+void AudioSequencer::playRow(uint32_t sampleRate) {
+	if (order == orderLength) {
+		// the last row has finished, and the song doesn't repeat
+		order = 0;
+		silence();
+		return;
+	}
+
+	uint8_t nextOrder = order;
+	uint8_t nextRow = row;
+	for (uint8_t i = 0; i < channelCount; i++) {
+		auto audioChannel = channels[baseChannel + i];
+		auto event = getEvent(nextOrder, nextRow, i);
+		if (event[2] == AUDIO_SEQUENCER_FX_TEMPO) {
+			if (event[3] > 0) {
+				tempo = event[3];
+			}
+		} else if (audioChannel) {
+			// the channel plays the event when it next renders, under its own lock
+			audioChannel->postRowEvent(event);
+		}
+	}
+
+	// move on, looping back to the restart position after the last pattern
+	if (++nextRow == rows) {
+		nextRow = 0;
+		if (++nextOrder == orderLength && restart < orderLength) {
+			nextOrder = restart;
+		}
+	}
+	order = nextOrder;
+	row = nextRow;
+
+	// rows don't fall on whole samples, so carry the remainder to keep in time
+	uint8_t bpm = tempo;
+	if (bpm != rowTempo) {
+		rowTempo = bpm;
+		rowRemainder = 0;
+	}
+	uint32_t rowsPerMinute = bpm * AUDIO_SEQUENCER_ROWS_PER_BEAT;
+	uint32_t length = sampleRate * 60 + rowRemainder;
+	rowSamples = length / rowsPerMinute;
+	rowRemainder = length % rowsPerMinute;
+	if (rowSamples == 0) {
+		// at very low sample rates rows can be shorter than a sample, but the mixer must move on
+		rowSamples = 1;
+	}
+}
+
+uint16_t AudioSequencer::noteFrequency(uint8_t note) {
+	static uint16_t frequencies[128];
+	static bool built = false;
+	if (!built) {
+		for (int i = 0; i < 128; i++) {
+			frequencies[i] = (uint16_t)lroundf(440.0f * powf(2.0f, (i - 69) / 12.0f));
+		}
+		built = true;
+	}
+	return frequencies[note];
+}
+
+#endif // AUDIO_SEQUENCER_H
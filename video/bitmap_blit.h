@@ -0,0 +1,313 @@
+#ifndef BITMAP_BLIT_H
+#define BITMAP_BLIT_H
+
+// Direct bitmap blits
+// Bitmaps are classified by their alpha values as opaque, colour-keyed (every pixel either
+// fully transparent or fully opaque) or true alpha.  Opaque and colour-keyed bitmaps can be
+// written straight into the framebuffer in the native pixel format, skipping fabgl's per-pixel
+// colour conversion.  Opaque rows are copied a byte or word at a time where alignment allows.
+//
+// Blits bypass the drawing queue, so can only be used when the queue has been flushed and
+// nothing else (sprites or the mouse cursor) is composited over the framebuffer
+//
+
+#include <algorithm>
+#include <memory>
+#include <string.h>
+#include <unordered_map>
+#include <fabgl.h>
+
+#include "agon.h"
+#include "agon_screen.h"
+#include "framebuffer.h"
+#include "mem_helpers.h"
+#include "native_bitmap.h"
+#include "types.h"
+
+enum class BitmapClass : uint8_t {
+	Opaque,				// No transparent pixels
+	ColourKey,			// Pixels are either fully transparent or fully opaque
+	Alpha,				// Partially transparent pixels, so can't be blitted directly
+};
+
+struct BlitBitmap {
+	std::weak_ptr<Bitmap>		bitmap;			// Bitmap this was built from, to detect replaced bitmaps
+	uint16_t					version;		// Value of nativeColourVersion when built
+	BitmapClass					type;
+	const uint8_t *				pixels;			// Native pixel values, one byte per pixel
+	std::unique_ptr<uint8_t[]>	ownPixels;		// Storage for pixels, unless the bitmap is already native
+	std::unique_ptr<uint8_t[]>	mask;			// One bit per pixel, MSB first, set where opaque (colour-keyed only)
+	std::unique_ptr<uint8_t[]>	packed;			// Opaque rows packed as in the framebuffer, starting on a byte boundary
+	uint16_t					packedRowBytes;
+};
+
+std::unordered_map<uint16_t, BlitBitmap> blitBitmaps;	// Blit data, by bitmap ID
+
+// Classify a bitmap by its alpha values
+//
+BitmapClass classifyBitmap(const Bitmap * bitmap) {
+	uint32_t pixelCount = bitmap->width * bitmap->height;
+	bool transparent = false;
+	switch (bitmap->format) {
+		case PixelFormat::Native:
+			return BitmapClass::Opaque;
+		case PixelFormat::RGBA8888:
+			for (uint32_t i = 0; i < pixelCount; i++) {
+				auto alpha = bitmap->data[i * 4 + 3];
+				if (alpha != 0 && alpha != 0xFF) {
+					return BitmapClass::Alpha;
+				}
+				transparent |= alpha == 0;
+			}
+			break;
+		case PixelFormat::RGBA2222:
+			for (uint32_t i = 0; i < pixelCount; i++) {
+				auto alpha = bitmap->data[i] & 0xC0;
+				if (alpha != 0 && alpha != 0xC0) {
+					return BitmapClass::Alpha;
+				}
+				transparent |= alpha == 0;
+			}
+			break;
+		default:
+			// mask bitmaps are drawn in the current colour, so leave them to fabgl
+			return BitmapClass::Alpha;
+	}
+	return transparent ? BitmapClass::ColourKey : BitmapClass::Opaque;
+}
+
+// Build blit data for a bitmap in the current mode
+// Returns false if the bitmap can't be blitted
+//
+bool buildBlitBitmap(BlitBitmap &blit, std::shared_ptr<Bitmap> bitmap) {
+	blit.bitmap = bitmap;
+	blit.version = nativeColourVersion;
+	blit.type = classifyBitmap(bitmap.get());
+	blit.ownPixels.reset();
+	blit.mask.reset();
+	blit.packed.reset();
+	if (blit.type == BitmapClass::Alpha) {
+		return false;
+	}
+
+	int width = bitmap->width;
+	int height = bitmap->height;
+	uint32_t pixelCount = width * height;
+	if (bitmap->format == PixelFormat::Native) {
+		blit.pixels = bitmap->data;
+	} else {
+		blit.ownPixels = make_unique_psram_array<uint8_t>(pixelCount);
+		if (!blit.ownPixels) {
+			return false;
+		}
+		uint8_t lut[64];
+		buildNativeColourLUT(lut);
+		auto source = bitmap->data;
+		auto pixels = blit.ownPixels.get();
+		bool rgba8888 = bitmap->format == PixelFormat::RGBA8888;
+		for (uint32_t i = 0; i < pixelCount; i++) {
+			uint8_t rgb222 = rgba8888
+				? (source[i * 4] >> 6) | ((source[i * 4 + 1] >> 6) << 2) | ((source[i * 4 + 2] >> 6) << 4)
+				: source[i] & 0x3F;
+			pixels[i] = lut[rgb222];
+		}
+		blit.pixels = pixels;
+	}
+
+	if (blit.type == BitmapClass::ColourKey) {
+		auto rowBytes = (width + 7) >> 3;
+		blit.mask = make_unique_psram_array<uint8_t>(rowBytes * height);
+		if (!blit.mask) {
+			return false;
+		}
+		memset(blit.mask.get(), 0, rowBytes * height);
+		bool rgba8888 = bitmap->format == PixelFormat::RGBA8888;
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				auto i = y * width + x;
+				bool opaque = rgba8888 ? bitmap->data[i * 4 + 3] != 0 : (bitmap->data[i] & 0xC0) != 0;
+				if (opaque) {
+					blit.mask[y * rowBytes + (x >> 3)] |= 0x80 >> (x & 7);
+				}
+			}
+		}
+		return true;
+	}
+
+	// opaque bitmaps in modes with whole pixels per byte get rows pre-packed for byte copies
+	auto depth = getVGAColourDepth();
+	uint8_t pixelsPerByte = depth == 2 ? 8 : depth == 4 ? 4 : depth == 16 ? 2 : 0;
+	if (pixelsPerByte) {
+		blit.packedRowBytes = (width + pixelsPerByte - 1) / pixelsPerByte;
+		blit.packed = make_unique_psram_array<uint8_t>(blit.packedRowBytes * height);
+		if (blit.packed) {
+			memset(blit.packed.get(), 0, blit.packedRowBytes * height);
+			for (int y = 0; y < height; y++) {
+				auto row = &blit.packed[y * blit.packedRowBytes];
+				for (int x = 0; x < width; x++) {
+					setNativePixel(row, x, depth, blit.pixels[y * width + x]);
+				}
+			}
+		}
+	}
+	return true;
+}
+
+// Drop blit data for bitmaps that no longer exist
+//
+void pruneBlitBitmaps() {
+	for (auto it = blitBitmaps.begin(); it != blitBitmaps.end();) {
+		if (it->second.bitmap.expired()) {
+			it = blitBitmaps.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+// Get blit data for a bitmap, building it if it's missing or out of date
+//
+BlitBitmap * getBlitBitmap(uint16_t bitmapId, std::shared_ptr<Bitmap> bitmap) {
+	if (blitBitmaps.find(bitmapId) == blitBitmaps.end()) {
+		pruneBlitBitmaps();
+	}
+	auto &blit = blitBitmaps[bitmapId];
+	if (blit.bitmap.lock() != bitmap || blit.version != nativeColourVersion) {
+		if (!buildBlitBitmap(blit, bitmap) && blit.type != BitmapClass::Alpha) {
+			// allocation failed, so try again next time
+			blit.bitmap.reset();
+			return nullptr;
+		}
+	}
+	return &blit;
+}
+
+// Write an opaque row of native pixels to a framebuffer row, from x1 to x2 inclusive
+// source points to the pixel for x1
+//
+void blitOpaqueRow(uint8_t * row, int x1, int x2, const uint8_t * source, uint8_t depth) {
+	auto x = x1;
+	if (depth == 64) {
+		// pixels are stored with each pair of 16-bit halves swapped, so write whole aligned words
+		while (x <= x2 && (x & 3)) {
+			setNativePixel(row, x++, depth, *source++);
+		}
+		while (x + 3 <= x2) {
+			uint32_t value = source[2] | (source[3] << 8) | (source[0] << 16) | (source[1] << 24);
+			write32_aligned(row + x, (read32_aligned(row + x) & 0xC0C0C0C0) | value);
+			source += 4;
+			x += 4;
+		}
+	}
+	while (x <= x2) {
+		setNativePixel(row, x++, depth, *source++);
+	}
+}
+
+// Blit a bitmap to the framebuffer at (x, y), clipped to a rectangle
+// Returns false if the bitmap can't be blitted, in which case nothing has been drawn
+//
+bool blitBitmap(uint16_t bitmapId, std::shared_ptr<Bitmap> bitmap, int x, int y, const Rect &clip) {
+	auto blit = getBlitBitmap(bitmapId, bitmap);
+	if (!blit || blit->type == BitmapClass::Alpha) {
+		return false;
+	}
+
+	int width = bitmap->width;
+	int x1 = std::max(std::max(x, (int)clip.X1), 0);
+	int y1 = std::max(std::max(y, (int)clip.Y1), 0);
+	int x2 = std::min(std::min(x + width - 1, (int)clip.X2), canvasW - 1);
+	int y2 = std::min(std::min(y + bitmap->height - 1, (int)clip.Y2), canvasH - 1);
+	if (x1 > x2 || y1 > y2) {
+		return true;
+	}
+
+	waitPlotCompletion();
+	auto depth = getVGAColourDepth();
+	uint8_t pixelsPerByte = depth == 2 ? 8 : depth == 4 ? 4 : depth == 16 ? 2 : 0;
+	auto maskRowBytes = (width + 7) >> 3;
+
+	for (int py = y1; py <= y2; py++) {
+		auto row = getFramebufferRow(py);
+		auto sy = py - y;
+		auto source = &blit->pixels[sy * width];
+		if (blit->type == BitmapClass::ColourKey) {
+			auto mask = &blit->mask[sy * maskRowBytes];
+			for (int px = x1; px <= x2; px++) {
+				auto sx = px - x;
+				if (mask[sx >> 3] & (0x80 >> (sx & 7))) {
+					setNativePixel(row, px, depth, source[sx]);
+				}
+			}
+		} else if (blit->packed && (x % pixelsPerByte) == 0 && (x1 % pixelsPerByte) == 0) {
+			// whole bytes line up with the framebuffer, so copy them, leaving any partial last byte
+			auto bytes = (x2 - x1 + 1) / pixelsPerByte;
+			memcpy(row + x1 / pixelsPerByte, &blit->packed[sy * blit->packedRowBytes + (x1 - x) / pixelsPerByte], bytes);
+			auto done = x1 + bytes * pixelsPerByte;
+			blitOpaqueRow(row, done, x2, source + (done - x), depth);
+		} else {
+			blitOpaqueRow(row, x1, x2, source + (x1 - x), depth);
+		}
+	}
+	return true;
+}
+
+// Capture a screen area at (x, y) into a native format bitmap of the same size, which must be on screen
+// Where the area starts on a byte boundary the raw framebuffer rows are kept as the bitmap's packed rows,
+// so drawing the capture back at the same alignment is a copy per row
+//
+void captureNativeBitmap(uint16_t bitmapId, std::shared_ptr<Bitmap> bitmap, int x, int y) {
+	int width = bitmap->width;
+	int height = bitmap->height;
+	auto pixels = (uint8_t *)bitmap->data;
+	auto depth = getVGAColourDepth();
+	uint8_t pixelsPerByte = depth == 2 ? 8 : depth == 4 ? 4 : depth == 16 ? 2 : 0;
+
+	blitBitmaps.erase(bitmapId);
+	pruneBlitBitmaps();
+	auto &blit = blitBitmaps[bitmapId];
+	blit.bitmap = bitmap;
+	blit.version = nativeColourVersion;
+	blit.type = BitmapClass::Opaque;
+	blit.pixels = pixels;
+	if (pixelsPerByte && (x % pixelsPerByte) == 0) {
+		blit.packedRowBytes = (width + pixelsPerByte - 1) / pixelsPerByte;
+		blit.packed = make_unique_psram_array<uint8_t>(blit.packedRowBytes * height);
+	}
+
+	waitPlotCompletion();
+	for (int py = 0; py < height; py++) {
+		auto row = getFramebufferRow(y + py);
+		auto dest = &pixels[py * width];
+		if (blit.packed) {
+			// bits past the end of the area in the last byte are left as they were on screen, and never copied back
+			auto packedRow = &blit.packed[py * blit.packedRowBytes];
+			memcpy(packedRow, row + x / pixelsPerByte, blit.packedRowBytes);
+			for (int px = 0; px < width; px++) {
+				dest[px] = getNativePixel(packedRow, px, depth);
+			}
+		} else {
+			int px = 0;
+			if (depth == 64) {
+				// read whole aligned words, undoing the swapped 16-bit halves and dropping the sync bits
+				while (px < width && ((x + px) & 3)) {
+					dest[px] = getNativePixel(row, x + px, depth);
+					px++;
+				}
+				while (px + 4 <= width) {
+					auto value = read32_aligned(row + x + px) & 0x3F3F3F3F;
+					dest[px] = value >> 16;
+					dest[px + 1] = value >> 24;
+					dest[px + 2] = value;
+					dest[px + 3] = value >> 8;
+					px += 4;
+				}
+			}
+			for (; px < width; px++) {
+				dest[px] = getNativePixel(row, x + px, depth);
+			}
+		}
+	}
+}
+
+#endif // BITMAP_BLIT_H
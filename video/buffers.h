@@ -32,14 +32,14 @@ void reverseValues(uint8_t * data, uint32_t length, uint16_t valueSize) {
 
 	if (valueSize == 1) {
 		// reverse the data
-		for (auto i = 0; i <= (bufferEnd / 2); i++) {
+		for (uint32_t i = 0; i <= (bufferEnd / 2); i++) {
 			auto temp = data[i];
 			data[i] = data[bufferEnd - i];
 			data[bufferEnd - i] = temp;
 		}
 	} else {
 		// reverse the data in chunks
-		for (auto i = 0; i <= (bufferEnd / (valueSize * 2)); i++) {
+		for (uint32_t i = 0; i <= (bufferEnd / (valueSize * 2)); i++) {
 			auto sourceOffset = i * valueSize;
 			auto targetOffset = bufferEnd - sourceOffset;
 			for (auto j = 0; j < valueSize; j++) {
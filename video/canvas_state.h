@@ -0,0 +1,150 @@
+#ifndef CANVAS_STATE_H
+#define CANVAS_STATE_H
+
+// Canvas state tracking
+// Sits between the contexts and the fabgl canvas, remembering the drawing state most recently
+// sent so that state primitives that wouldn't change anything are not added to the drawing queue.
+// Runs of single-row spans that stack vertically are also batched up into rectangles.
+//
+// Points and lines are not batched.  Each arrives as its own plot command, and text, bitmaps,
+// sprites and direct framebuffer access all use the canvas without coming through here, so a
+// point or line held back between commands would need a flush at every one of those.  Merging
+// lines that continue one another would also change what's drawn in XOR and invert modes, where
+// the shared end point is drawn twice, and fabgl has no open polyline primitive to send instead.
+// Spans are only batched within the fill that makes them, which flushes before it returns.
+//
+// Anything that changes the canvas state without going through here must call invalidate()
+//
+
+#include <memory>
+#include <string.h>
+#include <fabgl.h>
+
+extern std::unique_ptr<fabgl::Canvas> canvas;
+
+#define CANVAS_STATE_PEN_COLOR		0x01
+#define CANVAS_STATE_BRUSH_COLOR	0x02
+#define CANVAS_STATE_PAINT_OPTIONS	0x04
+#define CANVAS_STATE_CLIPPING_RECT	0x08
+#define CANVAS_STATE_LINE_OPTIONS	0x10
+#define CANVAS_STATE_PEN_WIDTH		0x20
+
+class CanvasState {
+	public:
+		// Forget everything we know about the canvas state
+		inline void invalidate() {
+			flush();
+			valid = 0;
+		}
+
+		inline void setPenColor(RGB888 colour) {
+			if (!(valid & CANVAS_STATE_PEN_COLOR) || !(penColor == colour)) {
+				flush();
+				canvas->setPenColor(colour);
+				penColor = colour;
+				valid |= CANVAS_STATE_PEN_COLOR;
+			}
+		}
+
+		inline void setBrushColor(RGB888 colour) {
+			if (!(valid & CANVAS_STATE_BRUSH_COLOR) || !(brushColor == colour)) {
+				flush();
+				canvas->setBrushColor(colour);
+				brushColor = colour;
+				valid |= CANVAS_STATE_BRUSH_COLOR;
+			}
+		}
+
+		// Options are compared bytewise, so at worst an unused bit difference sends a redundant primitive
+		inline void setPaintOptions(fabgl::PaintOptions options) {
+			if (!(valid & CANVAS_STATE_PAINT_OPTIONS) || memcmp(&paintOptions, &options, sizeof(options)) != 0) {
+				flush();
+				canvas->setPaintOptions(options);
+				paintOptions = options;
+				valid |= CANVAS_STATE_PAINT_OPTIONS;
+			}
+		}
+
+		inline void setClippingRect(Rect rect) {
+			if (!(valid & CANVAS_STATE_CLIPPING_RECT) || clippingRect.X1 != rect.X1 || clippingRect.Y1 != rect.Y1
+				|| clippingRect.X2 != rect.X2 || clippingRect.Y2 != rect.Y2) {
+				flush();
+				canvas->setClippingRect(rect);
+				clippingRect = rect;
+				valid |= CANVAS_STATE_CLIPPING_RECT;
+			}
+		}
+
+		inline void setLineOptions(fabgl::LineOptions options) {
+			if (!(valid & CANVAS_STATE_LINE_OPTIONS) || memcmp(&lineOptions, &options, sizeof(options)) != 0) {
+				flush();
+				canvas->setLineOptions(options);
+				lineOptions = options;
+				valid |= CANVAS_STATE_LINE_OPTIONS;
+			}
+		}
+
+		inline void setPenWidth(int width) {
+			if (!(valid & CANVAS_STATE_PEN_WIDTH) || penWidth != width) {
+				flush();
+				canvas->setPenWidth(width);
+				penWidth = width;
+				valid |= CANVAS_STATE_PEN_WIDTH;
+			}
+		}
+
+		// Tracked values, for code that writes to the framebuffer directly
+		inline bool getPaintOptions(fabgl::PaintOptions &options) {
+			options = paintOptions;
+			return valid & CANVAS_STATE_PAINT_OPTIONS;
+		}
+
+		inline bool getClippingRect(Rect &rect) {
+			rect = clippingRect;
+			return valid & CANVAS_STATE_CLIPPING_RECT;
+		}
+
+		// Queue a single-row span, drawn with the brush colour
+		// Spans that extend the pending rectangle up or down by a row are merged into it
+		// flush() must be called before any other drawing primitive is sent to the canvas
+		inline void fillSpan(int16_t x1, int16_t x2, int16_t y) {
+			if (spanPending && x1 == spanX1 && x2 == spanX2) {
+				if (y == spanY2 + 1) {
+					spanY2 = y;
+					return;
+				}
+				if (y == spanY1 - 1) {
+					spanY1 = y;
+					return;
+				}
+			}
+			flush();
+			spanPending = true;
+			spanX1 = x1;
+			spanX2 = x2;
+			spanY1 = spanY2 = y;
+		}
+
+		inline void flush() {
+			if (spanPending) {
+				spanPending = false;
+				canvas->fillRectangle(spanX1, spanY1, spanX2, spanY2);
+			}
+		}
+
+	private:
+		uint8_t					valid = 0;		// Which of the tracked values are known
+		RGB888					penColor;
+		RGB888					brushColor;
+		fabgl::PaintOptions		paintOptions;
+		Rect					clippingRect;
+		fabgl::LineOptions		lineOptions;
+		int						penWidth = 1;
+
+		bool					spanPending = false;
+		int16_t					spanX1, spanX2, spanY1, spanY2;
+};
+
+CanvasState		canvasState;			// Tracked state for the canvas
+
+#endif // CANVAS_STATE_H
@@ -11,7 +11,11 @@
 #include <fabgl.h>
 
 #include "agon.h"
+#include "buffer_stream.h"
 #include "sprites.h"
+#include "test_flags.h"
+#include "tile_map.h"
+#include "types.h"
 
 // Support structures
 
@@ -42,17 +46,36 @@ enum class ViewportType : uint8_t {
 };
 
 
+// Font tracking
+// "activating" a context will need to set the font to the current font
+//
+struct ContextFonts {
+	std::shared_ptr<fabgl::FontInfo>	font;				// Current active font
+	std::shared_ptr<fabgl::FontInfo>	textFont;			// Current active font for text cursor
+	std::shared_ptr<fabgl::FontInfo>	graphicsFont;		// Current active font for graphics cursor
+	std::shared_ptr<BufferStream>		textFontData;
+	std::shared_ptr<BufferStream>		graphicsFontData;
+};
+
+// Copy-on-write access to state shared between copies of a context
+// Saving a context only bumps reference counts, and the first write after that takes a private copy
+//
+template<typename T>
+inline T & writableShared(std::shared_ptr<T> &state) {
+	if (state.use_count() > 1) {
+		state = make_shared_psram<T>(*state);
+	}
+	return *state;
+}
+
+
 // Context object
 //
 class Context {
 	private:
-		// Font tracking
-		// "activating" a context will need to set the font to the current font
-		std::shared_ptr<fabgl::FontInfo>	font;				// Current active font
-		std::shared_ptr<fabgl::FontInfo>	textFont;			// Current active font for text cursor
-		std::shared_ptr<fabgl::FontInfo>	graphicsFont;		// Current active font for graphics cursor
-		std::shared_ptr<BufferStream>		textFontData;
-		std::shared_ptr<BufferStream>		graphicsFontData;
+		// Rarely changed state, shared between copies of a context
+		std::shared_ptr<ContextFonts>	fontState = make_shared_psram<ContextFonts>();	// Font tracking
+		std::shared_ptr<std::vector<uint16_t>>	charToBitmap = make_shared_psram<std::vector<uint16_t>>(256, 65535);	// character to bitmap mapping
 
 		// Cursor management data
 		bool			cursorEnabled = true;			// Cursor visibility
@@ -94,7 +117,6 @@ class Context {
 		uint16_t		bitmapTransform = -1;			// Bitmap transform buffer ID
 		fabgl::LinePattern	linePattern = fabgl::LinePattern();				// Dotted line pattern
 		uint8_t			linePatternLength = 8;			// Dotted line pattern length
-		std::vector<uint16_t>	charToBitmap = std::vector<uint16_t>(256, 65535);	// character to bitmap mapping
 		bool			plottingText = false;			// Are we currently plotting text?
 
 		bool			logicalCoords = true;			// Use BBC BASIC logical coordinates
@@ -142,7 +164,7 @@ class Context {
 		char getScreenChar(Point p);
 		inline void setCharacterOverwrite(bool overwrite);		// TODO integrate into setActiveCursor?
 		inline std::shared_ptr<Bitmap> getBitmapFromChar(uint8_t c) {
-			return getBitmap(charToBitmap[c]);
+			return getBitmap((*charToBitmap)[c]);
 		}
 
 		// Graphics functions
@@ -158,22 +180,25 @@ class Context {
 		void plotLine(bool omitFirstPoint, bool omitLastPoint, bool usePattern, bool resetPattern);
 		void plotPoint();
 		void fillHorizontalLine(bool scanLeft, bool match, RGB888 matchColor);
+		void plotFloodFill(bool match, RGB888 matchColor);
 		void plotTriangle();
 		void plotRectangle();
 		void plotParallelogram();
 		void plotCircle(bool filled);
+		void plotEllipse(bool filled);
 		void plotArc();
 		void plotSegment();
 		void plotSector();
 		void plotCopyMove(uint8_t mode);
 		void plotPath(uint8_t mode, uint8_t lastMode);
 		void plotBitmap(uint8_t mode);
+		bool canBlitDirect(Rect &clip);
 
 		void clearViewport(ViewportType viewport);
 		void scrollRegion(Rect * region, uint8_t direction, int16_t movement);
 
-		uint16_t scanH(int16_t x, int16_t y, RGB888 colour, int8_t direction);
-		uint16_t scanHToMatch(int16_t x, int16_t y, RGB888 colour, int8_t direction);
+		uint16_t scanH(int16_t x, int16_t y, uint8_t colour, int8_t direction);
+		uint16_t scanHToMatch(int16_t x, int16_t y, uint8_t colour, int8_t direction);
 
 	public:
 
@@ -183,8 +208,15 @@ class Context {
 			reset();
 		};
 
-		// Copy constructor
+		// Copy constructor, and assignment, which lets a spare context be reused for a copy
 		Context(const Context &c);
+		Context & operator=(const Context &c);
+		// Drop shared state held by a spare context, so it doesn't force copies on write elsewhere
+		// A spare context must be assigned to before it is used again
+		void releaseShared() {
+			fontState.reset();
+			charToBitmap.reset();
+		}
 
 		// Cursor management functions
 		void hideCursor();
@@ -275,6 +307,9 @@ class Context {
 
 		void setAffineTransform(uint8_t flags, uint16_t bufferId);
 
+		void drawTileMap();
+		void scrollTileMapTo(int16_t x, int16_t y);
+
 		void cls();
 		void clg();
 		void scrollRegion(ViewportType viewport, uint8_t direction, int16_t movement);
@@ -289,15 +324,20 @@ class Context {
 };
 
 
- Context::Context(const Context &c) {
-	// Copy all the data
+// Font tracking and character to bitmap mappings are shared until one of the contexts changes them
+// they are set in the initialiser list so that their default allocations are skipped
+Context::Context(const Context &c) : fontState(c.fontState), charToBitmap(c.charToBitmap) {
+	*this = c;
+}
 
-	// Font tracking
-	font = c.font;
-	textFont = c.textFont;
-	graphicsFont = c.graphicsFont;
-	textFontData = c.textFontData;
-	graphicsFontData = c.graphicsFontData;
+// Everything other than the shared state is plain values, so this is a flat copy plus reference
+// count bumps, with no allocations
+Context & Context::operator=(const Context &c) {
+	if (this == &c) {
+		return *this;
+	}
+	fontState = c.fontState;
+	charToBitmap = c.charToBitmap;
 
 	// Text cursor management data
 	cursorEnabled = c.cursorEnabled;
@@ -343,6 +383,11 @@ class Context {
 	rp1 = c.rp1;
 	up1 = c.up1;
 	// pathPoints and lastPlotCommand are currently completely transient, so don't need to be copied
+	// but a reused context may have been left with some
+	pathPoints.clear();
+	lastPlotCommand = 0;
+	plottingText = false;
+	bitmapTransform = -1;
 
 	// Text painting options
 	tfg = c.tfg;
@@ -351,7 +396,6 @@ class Context {
 	tbgc = c.tbgc;
 	tpo = c.tpo;
 	cpo = c.cpo;
-	charToBitmap = c.charToBitmap;
 
 	if (c.activeCursor == &c.textCursor) {
 		activeCursor = &textCursor;
@@ -364,6 +408,7 @@ class Context {
 	} else {
 		activeViewport = &textViewport;
 	}
+	return *this;
 }
 
 
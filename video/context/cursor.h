@@ -258,13 +258,13 @@ inline void Context::setActiveCursor(CursorType type) {
 	switch (type) {
 		case CursorType::Text:
 			activeCursor = &textCursor;
-			changeFont(textFont, textFontData, 0);
+			changeFont(fontState->textFont, fontState->textFontData, 0);
 			setCharacterOverwrite(true);
 			setActiveViewport(ViewportType::Text);
 			break;
 		case CursorType::Graphics:
 			activeCursor = &p1;
-			changeFont(graphicsFont, graphicsFontData, 0);
+			changeFont(fontState->graphicsFont, fontState->graphicsFontData, 0);
 			setCharacterOverwrite(false);
 			setActiveViewport(ViewportType::Graphics);
 			break;
@@ -14,7 +14,7 @@
 // Get pointer to our currently selected font
 //
 const fabgl::FontInfo * Context::getFont() {
-	return font == nullptr ? canvas->getFontInfo() : font.get();
+	return fontState->font == nullptr ? canvas->getFontInfo() : fontState->font.get();
 }
 
 void Context::changeFont(std::shared_ptr<fabgl::FontInfo> newFont, std::shared_ptr<BufferStream> fontData, uint8_t flags) {
@@ -56,13 +56,22 @@ void Context::changeFont(std::shared_ptr<fabgl::FontInfo> newFont, std::shared_p
 	}
 
 	canvas->selectFont(newFontPtr);
-	font = newFont;
-	if (textCursorActive()) {
-		textFont = newFont;
-		textFontData = fontData;
-	} else {
-		graphicsFont = newFont;
-		graphicsFontData = fontData;
+
+	// only take a private copy of our font state if something has actually changed
+	auto isText = textCursorActive();
+	auto &current = *fontState;
+	if (current.font != newFont
+		|| (isText && (current.textFont != newFont || current.textFontData != fontData))
+		|| (!isText && (current.graphicsFont != newFont || current.graphicsFontData != fontData))) {
+		auto &state = writableShared(fontState);
+		state.font = newFont;
+		if (isText) {
+			state.textFont = newFont;
+			state.textFontData = fontData;
+		} else {
+			state.graphicsFont = newFont;
+			state.graphicsFontData = fontData;
+		}
 	}
 }
 
@@ -168,16 +177,12 @@ void Context::resetFonts() {
 	if (!ttxtMode) {
 		canvas->selectFont(&FONT_AGON);
 	}
-	font = nullptr;
-	textFont = nullptr;
-	graphicsFont = nullptr;
-	textFontData = nullptr;
-	graphicsFontData = nullptr;
+	fontState = make_shared_psram<ContextFonts>();
 	setCharacterOverwrite(true);
 }
 
 bool Context::usingSystemFont() {
-	return font == nullptr;
+	return fontState->font == nullptr;
 }
 
 // Try and match a character at given text position
@@ -197,17 +202,23 @@ char Context::getScreenCharAt(uint16_t px, uint16_t py) {
 
 void Context::mapCharToBitmap(char c, uint16_t bitmapId) {
 	auto bitmap = getBitmap(bitmapId);
+	auto &mapping = writableShared(charToBitmap);
 	if (bitmap) {
-		charToBitmap[c] = bitmapId;
+		mapping[c] = bitmapId;
 	} else {
 		debug_log("mapCharToBitmap: bitmap %d not found\n\r", bitmapId);
-		charToBitmap[c] = 65535;
+		mapping[c] = 65535;
 	}
 }
 
 void Context::unmapBitmapFromChars(uint16_t bitmapId) {
 	// remove this bitmap from the charToBitmap mapping
-	for (auto it = charToBitmap.begin(); it != charToBitmap.end(); it++) {
+	// checking first, so a shared mapping is only copied if it's actually changing
+	if (std::find(charToBitmap->begin(), charToBitmap->end(), bitmapId) == charToBitmap->end()) {
+		return;
+	}
+	auto &mapping = writableShared(charToBitmap);
+	for (auto it = mapping.begin(); it != mapping.end(); it++) {
 		if (*it == bitmapId) {
 			*it = 65535;
 		}
@@ -215,7 +226,8 @@ void Context::unmapBitmapFromChars(uint16_t bitmapId) {
 }
 
 void Context::resetCharToBitmap() {
-	std::fill(charToBitmap.begin(), charToBitmap.end(), 65535);
+	auto &mapping = writableShared(charToBitmap);
+	std::fill(mapping.begin(), mapping.end(), 65535);
 }
 
 #endif // CONTEXT_FONTS_H
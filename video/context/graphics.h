@@ -2,6 +2,7 @@
 #define CONTEXT_GRAPHICS_H
 
 #include <algorithm>
+#include <cstdlib>
 #include <vector>
 
 #include <fabgl.h>
@@ -10,8 +11,12 @@
 #include "agon_ps2.h"
 #include "agon_screen.h"
 #include "agon_palette.h"
+#include "affine_blit.h"
 #include "agon_ttxt.h"
+#include "bitmap_blit.h"
 #include "buffers.h"
+#include "flood_fill.h"
+#include "framebuffer.h"
 #include "sprites.h"
 #include "types.h"
 
@@ -41,19 +46,19 @@ void Context::setGraphicsOptions(uint8_t mode) {
 		case 0: break;	// move command
 		case 1: {
 			// use fg colour
-			canvas->setPenColor(gfg);
-			canvas->setPaintOptions(gpofg);
+			canvasState.setPenColor(gfg);
+			canvasState.setPaintOptions(gpofg);
 		} break;
 		case 2: {
 			// logical inverse colour - override paint options
 			auto options = getPaintOptions(fabgl::PaintMode::Invert, gpofg);
-			canvas->setPaintOptions(options);
+			canvasState.setPaintOptions(options);
 			return;
 		} break;
 		case 3: {
 			// use bg colour
-			canvas->setPenColor(gbg);
-			canvas->setPaintOptions(gpobg);
+			canvasState.setPenColor(gbg);
+			canvasState.setPaintOptions(gpobg);
 		} break;
 	}
 }
@@ -66,12 +71,12 @@ void Context::setGraphicsFill(uint8_t mode) {
 		case 0: break;	// move command
 		case 1: {
 			// use fg colour
-			canvas->setBrushColor(gfg);
+			canvasState.setBrushColor(gfg);
 		} break;
 		case 2: break;	// logical inverse colour (not suported)
 		case 3: {
 			// use bg colour
-			canvas->setBrushColor(gbg);
+			canvasState.setBrushColor(gbg);
 		} break;
 	}
 }
@@ -79,7 +84,7 @@ void Context::setGraphicsFill(uint8_t mode) {
 // Set a clipping rectangle
 //
 inline void Context::setClippingRect(Rect rect) {
-	canvas->setClippingRect(rect);
+	canvasState.setClippingRect(rect);
 }
 
 //// Graphics drawing routines (private)
@@ -120,7 +125,7 @@ void Context::plotLine(bool omitFirstPoint, bool omitLastPoint, bool usePattern,
 	if (resetPattern) {
 		canvas->setLinePatternOffset(0);
 	}
-	canvas->setLineOptions(lineOptions);
+	canvasState.setLineOptions(lineOptions);
 
 	canvas->lineTo(p1.X, p1.Y);
 }
@@ -136,8 +141,9 @@ void Context::plotPoint() {
 void Context::fillHorizontalLine(bool scanLeft, bool match, RGB888 matchColor) {
 	canvas->waitCompletion(false);
 	int16_t y = p1.Y;
-	int16_t x1 = scanLeft ? (match ? scanHToMatch(p1.X, y, matchColor, -1) : scanH(p1.X, y, matchColor, -1)) : p1.X;
-	int16_t x2 = match ? scanHToMatch(p1.X, y, matchColor, 1) : scanH(p1.X, y, matchColor, 1);
+	auto colour = getNativeColour(matchColor);
+	int16_t x1 = scanLeft ? (match ? scanHToMatch(p1.X, y, colour, -1) : scanH(p1.X, y, colour, -1)) : p1.X;
+	int16_t x2 = match ? scanHToMatch(p1.X, y, colour, 1) : scanH(p1.X, y, colour, 1);
 	debug_log("fillHorizontalLine: (%d, %d) transformed to (%d,%d) -> (%d,%d)\n\r", p1.X, p1.Y, x1, y, x2, y);
 
 	if (x1 == x2 || x1 > x2) {
@@ -154,6 +160,39 @@ void Context::fillHorizontalLine(bool scanLeft, bool match, RGB888 matchColor) {
 	pushPoint(p.X, up1.Y);
 }
 
+// Flood fill
+// match false fills pixels that are the given colour, true fills up to pixels of the given colour
+//
+void Context::plotFloodFill(bool match, RGB888 matchColor) {
+	auto &vp = graphicsViewport;
+	if (p1.X < vp.X1 || p1.X > vp.X2 || p1.Y < vp.Y1 || p1.Y > vp.Y2) {
+		return;
+	}
+	auto filler = make_unique_psram<FloodFill>(vp.X1, vp.Y1, vp.X2, vp.Y2);
+	if (!filler || !filler->isValid()) {
+		debug_log("plotFloodFill: unable to allocate fill mask\n\r");
+		return;
+	}
+	waitPlotCompletion();
+	auto depth = getVGAColourDepth();
+	auto colour = getNativeColour(matchColor);
+	const uint8_t * row = nullptr;
+	int16_t rowY = -1;
+
+	auto inside = [&](int16_t x, int16_t y) {
+		if (y != rowY) {
+			row = getFramebufferRow(y);
+			rowY = y;
+		}
+		return (getNativePixel(row, x, depth) == colour) != match;
+	};
+	auto fillSpan = [](int16_t x1, int16_t x2, int16_t y) {
+		canvasState.fillSpan(x1, x2, y);
+	};
+	filler->fill(p1.X, p1.Y, inside, fillSpan);
+	canvasState.flush();
+}
+
 // Triangle plot
 //
 void Context::plotTriangle() {
@@ -200,6 +239,101 @@ void Context::plotCircle(bool filled) {
 	}
 }
 
+// Ellipse plot
+// Acorn-style: p3 is the centre, p2's X offset from the centre gives the horizontal semi-axis,
+// and p1 is the top (or bottom) of the ellipse, with its X offset from the centre giving the shear
+// The ellipse is drawn as horizontal spans, using the brush colour
+// Only rows inside the graphics viewport are worked out, and the semi-axes are saturated at
+// 32767 pixels, far beyond any screen, so the 64-bit midpoint terms can't overflow
+//
+void Context::plotEllipse(bool filled) {
+	auto &vp = graphicsViewport;
+	int32_t a = std::min<int32_t>(abs(p2.X - p3.X), 0x7FFF);
+	int32_t b = p1.Y - p3.Y;
+	int32_t shear = p1.X - p3.X;
+	int32_t rows = std::min<int32_t>(abs(b), 0x7FFF);
+
+	debug_log("plotEllipse: centre (%d,%d), a %d, b %d, shear %d\n\r", p3.X, p3.Y, a, b, shear);
+
+	// spans are clipped to the viewport here, so their ends fit in 16 bits
+	auto drawSpan = [&vp](int32_t x1, int32_t x2, int32_t y) {
+		if (x1 <= vp.X2 && x2 >= vp.X1) {
+			canvasState.fillSpan(std::max<int32_t>(x1, vp.X1), std::min<int32_t>(x2, vp.X2), y);
+		}
+	};
+
+	if (rows == 0) {
+		if (p3.Y >= vp.Y1 && p3.Y <= vp.Y2) {
+			drawSpan(p3.X - a, p3.X + a, p3.Y);
+			canvasState.flush();
+		}
+		return;
+	}
+
+	// row offsets from the centre that are on screen, and for outlines the rows either side of those
+	int32_t first = std::max<int32_t>(-rows, vp.Y1 - p3.Y);
+	int32_t last = std::min<int32_t>(rows, vp.Y2 - p3.Y);
+	if (first > last) {
+		return;
+	}
+	int32_t lo = std::max(-rows, first - 1);
+	int32_t hi = std::min(rows, last + 1);
+
+	// Half-width of the row dy rows from the centre
+	// a row includes the pixel w out from the centre when (w - 0.5)^2 * b^2 <= a^2 * (b^2 - dy^2)
+	// the estimate from the ellipse equation is corrected with the exact integer test
+	const int64_t a2x4 = 4 * (int64_t)a * a;
+	const int64_t b2 = (int64_t)rows * rows;
+	auto halfWidth = [&](int32_t dy) {
+		auto limit = a2x4 * (b2 - (int64_t)dy * dy);
+		auto includes = [&](int32_t w) { return (int64_t)(2 * w + 1) * (2 * w + 1) * b2 <= limit; };
+		float ratio = (float)dy / rows;
+		int32_t w = std::min<int32_t>(a, a * sqrtf(1.0f - ratio * ratio) + 0.5f);
+		while (w > 0 && !includes(w - 1)) {
+			w--;
+		}
+		while (w < a && includes(w)) {
+			w++;
+		}
+		return w;
+	};
+
+	// Work out span ends for every row, applying the shear
+	// row offsets are rounded to the nearest pixel
+	auto count = hi - lo + 1;
+	std::vector<int32_t> left(count);
+	std::vector<int32_t> right(count);
+	for (int32_t i = 0; i < count; i++) {
+		int32_t dy = lo + i;
+		int64_t n = (int64_t)shear * dy * (b < 0 ? -1 : 1);
+		int32_t offset = n >= 0 ? (n + rows / 2) / rows : -((rows / 2 - n) / rows);
+		auto w = halfWidth(abs(dy));
+		left[i] = p3.X + offset - w;
+		right[i] = p3.X + offset + w;
+	}
+
+	for (int32_t dy = first; dy <= last; dy++) {
+		auto i = dy - lo;
+		int32_t y = p3.Y + dy;
+		if (filled || dy == -rows || dy == rows) {
+			// filled rows, or the caps at the top and bottom of an outline
+			drawSpan(left[i], right[i], y);
+			continue;
+		}
+		// outline rows extend inwards far enough to meet the edges of the rows above and below
+		auto leftEnd = std::max(left[i], std::max(left[i - 1], left[i + 1]) - 1);
+		auto rightStart = std::min(right[i], std::min(right[i - 1], right[i + 1]) + 1);
+		if (rightStart - leftEnd <= 2) {
+			// edges meet, or would leave a single pixel gap
+			drawSpan(left[i], right[i], y);
+		} else {
+			drawSpan(left[i], leftEnd, y);
+			drawSpan(rightStart, right[i], y);
+		}
+	}
+	canvasState.flush();
+}
+
 // Arc plot
 void Context::plotArc() {
 	debug_log("plotArc: (%d,%d) -> (%d,%d), (%d,%d)\n\r", p3.X, p3.Y, p2.X, p2.Y, p1.X, p1.Y);
@@ -233,8 +367,8 @@ void Context::plotCopyMove(uint8_t mode) {
 	if (mode == 1 || mode == 5) {
 		// move rectangle needs to clear source rectangle
 		// being careful not to clear the destination rectangle
-		canvas->setBrushColor(gbg);
-		canvas->setPaintOptions(getPaintOptions(fabgl::PaintMode::Set, gpobg));
+		canvasState.setBrushColor(gbg);
+		canvasState.setPaintOptions(getPaintOptions(fabgl::PaintMode::Set, gpobg));
 		Rect sourceRect = Rect(sourceX, sourceY, sourceX + width, sourceY + height);
 		debug_log("plotCopyMove: source rectangle (%d,%d) -> (%d,%d)\n\r", sourceRect.X1, sourceRect.Y1, sourceRect.X2, sourceRect.Y2);
 		Rect destRect = Rect(destX, destY, destX + width, destY + height);
@@ -328,7 +462,7 @@ void Context::plotBitmap(uint8_t mode) {
 		auto paintOptions = getPaintOptions(gpobg.mode, gpobg);
 		// swapFGBG on bitmap plots indicates to plot using pen color instead of bitmap
 		paintOptions.swapFGBG = true;
-		canvas->setPaintOptions(paintOptions);
+		canvasState.setPaintOptions(paintOptions);
 	}
 	drawBitmap(p1.X, p1.Y, true, false);
 	plottingText = false;
@@ -349,9 +483,9 @@ void Context::scrollRegion(Rect * region, uint8_t direction, int16_t movement) {
 	auto moveX = 0;
 	auto moveY = 0;
 	canvas->setScrollingRegion(region->X1, region->Y1, region->X2, region->Y2);
-	canvas->setPenColor(tbg);
-	canvas->setBrushColor(tbg);
-	canvas->setPaintOptions(tpo);
+	canvasState.setPenColor(tbg);
+	canvasState.setBrushColor(tbg);
+	canvasState.setPaintOptions(tpo);
 	plottingText = false;
 	switch (direction) {
 		case 0:		// Right
@@ -410,49 +544,32 @@ void Context::scrollRegion(Rect * region, uint8_t direction, int16_t movement) {
 		}
 	}
 	if (textCursorActive()) {
-		canvas->setPenColor(tfg);
-		canvas->setBrushColor(tbg);
+		canvasState.setPenColor(tfg);
+		canvasState.setBrushColor(tbg);
 	} else {
-		canvas->setPenColor(gfg);
-		canvas->setBrushColor(gfg);
-		canvas->setPaintOptions(gpofg);
+		canvasState.setPenColor(gfg);
+		canvasState.setBrushColor(gfg);
+		canvasState.setPaintOptions(gpofg);
 	}
 }
 
 
-// Horizontal scan until we find a pixel not non-equalto given colour
+// Horizontal scan until we find a pixel not equal to given native colour
 // returns x coordinate for the last pixel before the match
-uint16_t Context::scanH(int16_t x, int16_t y, RGB888 colour, int8_t direction = 1) {
-	uint16_t w = direction > 0 ? canvas->getWidth() - 1 : 0;
-	if (x < 0 || x >= canvas->getWidth()) return x;
-
-	while (x != w) {
-		RGB888 pixel = canvas->getPixel(x, y);
-		if (pixel == colour) {
-			x += direction;
-		} else {
-			return x - direction;
-		}
-	}
+uint16_t Context::scanH(int16_t x, int16_t y, uint8_t colour, int8_t direction = 1) {
+	int16_t w = direction > 0 ? canvasW - 1 : 0;
+	if (x < 0 || x >= canvasW || y < 0 || y >= canvasH) return x;
 
-	return w;
+	return scanFramebufferRow(getFramebufferRow(y), x, w, direction, colour, true);
 }
 
-// Horizontal scan until we find a pixel matching the given colour
+// Horizontal scan until we find a pixel matching the given native colour
 // returns x coordinate for the last pixel before the match
-uint16_t Context::scanHToMatch(int16_t x, int16_t y, RGB888 colour, int8_t direction = 1) {
-	uint16_t w = direction > 0 ? canvas->getWidth() - 1 : 0;
-	if (x < 0 || x >= canvas->getWidth()) return x;
-
-	while (x != w) {
-		RGB888 pixel = canvas->getPixel(x, y);
-		if (pixel == colour) {
-			return x - direction;
-		}
-		x += direction;
-	}
+uint16_t Context::scanHToMatch(int16_t x, int16_t y, uint8_t colour, int8_t direction = 1) {
+	int16_t w = direction > 0 ? canvasW - 1 : 0;
+	if (x < 0 || x >= canvasW || y < 0 || y >= canvasH) return x;
 
-	return w;
+	return scanFramebufferRow(getFramebufferRow(y), x, w, direction, colour, false);
 }
 
 
@@ -460,7 +577,7 @@ uint16_t Context::scanHToMatch(int16_t x, int16_t y, RGB888 colour, int8_t direc
 
 void Context::setLineThickness(uint8_t thickness) {
 	lineThickness = thickness;
-	canvas->setPenWidth(thickness);
+	canvasState.setPenWidth(thickness);
 }
 
 void Context::setDottedLinePattern(uint8_t pattern[8]) {
@@ -491,7 +608,7 @@ void Context::setTextColour(uint8_t colour) {
 		tfg = colourLookup[c];
 		tfgc = col;
 		if (plottingText && textCursorActive()) {
-			canvas->setPenColor(tfg);
+			canvasState.setPenColor(tfg);
 		}
 		debug_log("vdu_colour: tfg %d = %02X : %02X,%02X,%02X\n\r", colour, c, tfg.R, tfg.G, tfg.B);
 	}
@@ -499,7 +616,7 @@ void Context::setTextColour(uint8_t colour) {
 		tbg = colourLookup[c];
 		tbgc = col;
 		if (plottingText && textCursorActive()) {
-			canvas->setBrushColor(tbg);
+			canvasState.setBrushColor(tbg);
 		}
 		debug_log("vdu_colour: tbg %d = %02X : %02X,%02X,%02X\n\r", colour, c, tbg.R, tbg.G, tbg.B);
 	}
@@ -692,8 +809,12 @@ bool IRAM_ATTR Context::plot(int16_t x, int16_t y, uint8_t command) {
 				fillHorizontalLine(false, false, gfg);
 				break;
 			case 0x80:	// flood to non-bg
+				setGraphicsFill(mode);
+				plotFloodFill(false, gbg);
+				break;
 			case 0x88:	// flood to fg
-				debug_log("plot flood fill not implemented\n\r");
+				setGraphicsFill(mode);
+				plotFloodFill(true, gfg);
 				break;
 			case 0x90:	// circle outline
 				plotCircle(false);
@@ -717,9 +838,12 @@ bool IRAM_ATTR Context::plot(int16_t x, int16_t y, uint8_t command) {
 				plotCopyMove(mode);
 				break;
 			case 0xC0:	// ellipse outline
+				setGraphicsFill(mode);
+				plotEllipse(false);
+				break;
 			case 0xC8:	// ellipse fill
-				// fab-gl's ellipse isn't compatible with BBC BASIC
-				debug_log("plot ellipse not implemented\n\r");
+				setGraphicsFill(mode);
+				plotEllipse(true);
 				break;
 			case 0xD8:	// plot path (unassigned on Acorn and other BBC BASIC versions)
 				plotPath(mode, lastPlotCommand & 0x03);
@@ -760,13 +884,13 @@ void Context::plotString(const std::string& s) {
 	if (!ttxtMode && !plottingText) {
 		if (textCursorActive()) {
 			setClippingRect(textViewport);
-			canvas->setPenColor(tfg);
-			canvas->setBrushColor(tbg);
-			canvas->setPaintOptions(tpo);
+			canvasState.setPenColor(tfg);
+			canvasState.setBrushColor(tbg);
+			canvasState.setPaintOptions(tpo);
 		} else {
 			setClippingRect(graphicsViewport);
-			canvas->setPenColor(gfg);
-			canvas->setPaintOptions(gpofg);
+			canvasState.setPenColor(gfg);
+			canvasState.setPaintOptions(gpofg);
 		}
 		plottingText = true;
 	}
@@ -800,12 +924,27 @@ void Context::plotBackspace() {
 	if (ttxtMode) {
 		ttxt_instance.draw_char(activeCursor->X, activeCursor->Y, ' ');
 	} else {
-		canvas->setBrushColor(textCursorActive() ? tbg : gbg);
+		canvasState.setBrushColor(textCursorActive() ? tbg : gbg);
 		canvas->fillRectangle(activeCursor->X, activeCursor->Y, activeCursor->X + getFont()->width - 1, activeCursor->Y + getFont()->height - 1);
 		plottingText = false;
 	}
 }
 
+// Check whether bitmaps can be written straight to the framebuffer, rather than queued for the canvas
+// This is only done with TEST_FLAG_DIRECT_BLIT set, and needs plain Set mode, and nothing (sprites or
+// the mouse cursor) composited over the framebuffer
+// Pending spans are flushed, and clip is set to the clipping rectangle
+//
+bool Context::canBlitDirect(Rect &clip) {
+	fabgl::PaintOptions options;
+	if (!isTestFlagSet(TEST_FLAG_DIRECT_BLIT) || hasActiveSprites() || mouseEnabled || !canvasState.getPaintOptions(options) || !canvasState.getClippingRect(clip)
+		|| options.mode != fabgl::PaintMode::Set || options.swapFGBG || options.NOT) {
+		return false;
+	}
+	canvasState.flush();
+	return true;
+}
+
 // draw bitmap
 //
 void Context::drawBitmap(uint16_t x, uint16_t y, bool compensateHeight, bool forceSet) {
@@ -813,38 +952,34 @@ void Context::drawBitmap(uint16_t x, uint16_t y, bool compensateHeight, bool for
 	if (bitmap) {
 		if (forceSet) {
 			auto options = getPaintOptions(fabgl::PaintMode::Set, gpofg);
-			canvas->setPaintOptions(options);
+			canvasState.setPaintOptions(options);
 		}
 		auto yPos = (compensateHeight && logicalCoords) ? (y + 1 - bitmap->height) : y;
+		Rect clip;
+		bool direct = canBlitDirect(clip);
 		if (bitmapTransform != 65535) {
-			auto transformBufferIter = buffers.find(bitmapTransform);
-			if (transformBufferIter != buffers.end()) {
-				auto &transformBuffer = transformBufferIter->second;
-				int const matrixSize = sizeof(float) * 9;
-				if (transformBuffer.size() == 1) {
-					// make sure we have an inverse matrix cached
-					if (transformBuffer[0]->size() < matrixSize) {
-						debug_log("drawBitmap: transform buffer %d has %d elements\n\r", bitmapTransform, transformBuffer[0]->size());
-						return;
-					}
-					// create an inverse matrix, and push that to the buffer
-					auto transform = (float *)transformBuffer[0]->getBuffer();
-					auto matrix = dspm::Mat(transform, 3, 3).inverse();
-					auto bufferStream = make_shared_psram<BufferStream>(matrixSize);
-					bufferStream->writeBuffer((uint8_t *)matrix.data, matrixSize);
-					transformBuffer.push_back(bufferStream);
+			auto transform = getAffineTransform(bitmapTransform);
+			if (transform) {
+				if (!transform->invertible) {
+					debug_log("drawBitmap: transform buffer %d is not invertible\n\r", bitmapTransform);
+					return;
 				}
 				// NB: if we're drawing via PLOT and are using OS coords, then we _should_ be using bottom left of bitmap as our "origin" for transforms
 				// however we're not doing that here - the origin for transforms is top left of the bitmap
 				// attempting to transform based on bottom left would require translates to be added to the matrix, custom for the bitmap being plotted
 				// which would mean they could not be cached
-
-				// we should have a valid transform buffer now, which includes an inverse chunk
-				canvas->drawTransformedBitmap(x, yPos, bitmap.get(), (float *)transformBuffer[0]->getBuffer(), (float *)transformBuffer[1]->getBuffer());
+				if (direct && blitTransformedBitmap(currentBitmap, bitmap, x, yPos, *transform, clip)) {
+					return;
+				}
+				transform->used = true;
+				canvas->drawTransformedBitmap(x, yPos, bitmap.get(), transform->matrix, transform->inverse);
 				return;
 			}
 			// if buffer not found, we should fall back to normal drawing
 		}
+		if (direct && blitBitmap(currentBitmap, bitmap, x, yPos, clip)) {
+			return;
+		}
 		canvas->drawBitmap(x, yPos, bitmap.get());
 	} else {
 		debug_log("drawBitmap: bitmap %d not found\n\r", currentBitmap);
@@ -857,12 +992,12 @@ void Context::drawCursor(Point p) {
 	if (textCursorActive()) {
 		auto font = getFont();
 		if (cursorHStart < font->width && cursorHStart <= cursorHEnd && cursorVStart < font->height && cursorVStart <= cursorVEnd) {
-			canvas->setPaintOptions(cpo);
-			canvas->setBrushColor(tbg);
+			canvasState.setPaintOptions(cpo);
+			canvasState.setBrushColor(tbg);
 			canvas->fillRectangle(p.X + cursorHStart, p.Y + cursorVStart, p.X + std::min(((int)cursorHEnd), font->width - 1), p.Y + std::min(((int)cursorVEnd), font->height - 1));
-			canvas->setBrushColor(tfg);
+			canvasState.setBrushColor(tfg);
 			canvas->fillRectangle(p.X + cursorHStart, p.Y + cursorVStart, p.X + std::min(((int)cursorHEnd), font->width - 1), p.Y + std::min(((int)cursorVEnd), font->height - 1));
-			canvas->setPaintOptions(tpo);
+			canvasState.setPaintOptions(tpo);
 			plottingText = false;
 		}
 	}
@@ -876,6 +1011,65 @@ void Context::setAffineTransform(uint8_t flags, uint16_t bufferId) {
 	}
 }
 
+// Draw the whole tile map into the graphics viewport
+//
+void Context::drawTileMap() {
+	if (!tileMap.isValid()) {
+		debug_log("drawTileMap: no tile map set\n\r");
+		return;
+	}
+	canvasState.setBrushColor(gbg);
+	canvasState.setPaintOptions(getPaintOptions(fabgl::PaintMode::Set, gpofg));
+	setClippingRect(graphicsViewport);
+	canvas->fillRectangle(graphicsViewport);
+	tileMap.drawArea(graphicsViewport, graphicsViewport);
+	tileMap.setDrawn(graphicsViewport);
+	setClippingRect(graphicsViewport);
+	plottingText = false;
+}
+
+// Move the tile map to a new scroll offset
+// The viewport is scrolled, and only the tiles in the newly exposed strips are drawn
+//
+void Context::scrollTileMapTo(int16_t x, int16_t y) {
+	int dx = x - tileMap.scrollX;
+	int dy = y - tileMap.scrollY;
+	tileMap.scrollX = x;
+	tileMap.scrollY = y;
+	auto &viewport = graphicsViewport;
+	if (!tileMap.isDrawnIn(viewport) || std::abs(dx) >= viewport.width() || std::abs(dy) >= viewport.height()) {
+		drawTileMap();
+		return;
+	}
+	if (dx == 0 && dy == 0) {
+		return;
+	}
+
+	canvasState.setBrushColor(gbg);
+	canvasState.setPaintOptions(getPaintOptions(fabgl::PaintMode::Set, gpofg));
+	canvas->setScrollingRegion(viewport.X1, viewport.Y1, viewport.X2, viewport.Y2);
+	canvas->scroll(-dx, -dy);
+
+	// columns exposed at the left or right edge
+	if (dx != 0) {
+		Rect strip = dx > 0 ? Rect(viewport.X2 - dx + 1, viewport.Y1, viewport.X2, viewport.Y2)
+							: Rect(viewport.X1, viewport.Y1, viewport.X1 - dx - 1, viewport.Y2);
+		setClippingRect(strip);
+		canvas->fillRectangle(strip);
+		tileMap.drawArea(viewport, strip);
+	}
+	// rows exposed at the top or bottom edge
+	if (dy != 0) {
+		Rect strip = dy > 0 ? Rect(viewport.X1, viewport.Y2 - dy + 1, viewport.X2, viewport.Y2)
+							: Rect(viewport.X1, viewport.Y1, viewport.X2, viewport.Y1 - dy - 1);
+		setClippingRect(strip);
+		canvas->fillRectangle(strip);
+		tileMap.drawArea(viewport, strip);
+	}
+	setClippingRect(graphicsViewport);
+	plottingText = false;
+}
+
 // Clear the screen
 //
 void Context::cls() {
@@ -883,12 +1077,13 @@ void Context::cls() {
 		activateSprites(0);
 	}
 	if (canvas) {
-		canvas->setPenColor(tfg);
-		canvas->setBrushColor(tbg);
-		canvas->setPaintOptions(tpo);
+		canvasState.setPenColor(tfg);
+		canvasState.setBrushColor(tbg);
+		canvasState.setPaintOptions(tpo);
 		setClippingRect(textViewport);
 		clearViewport(ViewportType::Text);
 		plottingText = true;
+		tileMap.invalidate();
 	}
 	cursorHome();
 	setPagedMode(pagedMode);
@@ -898,12 +1093,13 @@ void Context::cls() {
 //
 void Context::clg() {
 	if (canvas) {
-		canvas->setPenColor(gfg);
-		canvas->setBrushColor(gbg);
-		canvas->setPaintOptions(gpobg);
+		canvasState.setPenColor(gfg);
+		canvasState.setBrushColor(gbg);
+		canvasState.setPaintOptions(gpobg);
 		setClippingRect(graphicsViewport);
 		clearViewport(ViewportType::Graphics);
 		plottingText = false;
+		tileMap.invalidate();
 	}
 	pushPoint(0, 0);		// Reset graphics cursor position (as per BBC Micro CLG)
 }
@@ -966,7 +1162,7 @@ void Context::reset() {
 void Context::activate() {
 	plottingText = false;
 	if (!ttxtMode) {
-		canvas->selectFont(font == nullptr ? &FONT_AGON : font.get());
+		canvas->selectFont(fontState->font == nullptr ? &FONT_AGON : fontState->font.get());
 	}
 	setLineThickness(lineThickness);
 	// reset line pattern
@@ -1,99 +1,182 @@
 #ifndef ENHANCED_SAMPLES_GENERATOR_H
 #define ENHANCED_SAMPLES_GENERATOR_H
 
+#include <algorithm>
 #include <memory>
+#include <string.h>
 #include <vector>
 #include <unordered_map>
 #include <fabgl.h>
 
 #include "audio_sample.h"
 #include "types.h"
+#include "waveform_generators.h"
 
 // Enhanced samples generator
+// Playback position is a 32.32 fixed point phase: a whole number of samples to step on, and a 32-bit fraction.
+// Output is interpolated between the previous and current samples, either linearly or with a 4-point
+// Hermite curve, which also uses the samples either side of them.  Linear interpolation rounds as the
+// double-precision position it replaced did, so only a position that lands differently, from the
+// 32.32 step being exact where the double accumulated error, can change a sample
+// Samples are worked with at 16 bits, whatever their format, and only scaled to 8 bits with the volume
 //
-class EnhancedSamplesGenerator : public WaveformGenerator {
+class EnhancedSamplesGenerator : public BlockWaveformGenerator {
 	public:
 		EnhancedSamplesGenerator(std::shared_ptr<AudioSample> sample);
 
 		void setFrequency(int value);
 		void setSampleRate(int value);
-		int getSample();
+		void renderBlock(int16_t * buffer, int count);
 
 		int getDuration(uint16_t frequency);
 
 		void seekTo(uint32_t position);
+		void setInterpolation(uint8_t value) { interpolation = value; }
+		bool isStream() { return _sample->isStream(); }
+		bool isStreamLow() { return _sample->isStreamLow(); }
 	private:
 		std::shared_ptr<AudioSample> _sample;
 
-		uint32_t	index;				// Current index inside the current sample block
-		uint32_t	blockIndex;			// Current index into the sample data blocks
+		SampleCursor	cursor;			// Current position in the sample data
 		int32_t		repeatCount;		// Sample count when repeating
 		// TODO consider whether repeatStart and repeatLength may need to be here
 		// which would allow for per-channel repeat settings
 
 		int			frequency;
-		int			previousSample;
-		int			currentSample;
-		double		samplesPerGet;
-		double		fractionalSampleOffset;
+		int32_t		history[4];			// Samples before previous, previous, current, and next, at 16 bits
+		uint32_t	stepWhole;			// Phase step per output sample, whole samples
+		uint32_t	stepFraction;		// and fraction
+		uint32_t	pendingSamples;		// Whole samples to move on before the next output
+		uint32_t	fraction;			// Position between the previous and current samples
+		uint8_t		interpolation;
 
 		double calculateSamplerate(uint16_t frequency);
-		int8_t getNextSample();
+		void calculatePhaseStep();
+		template<uint8_t Format> void renderSamples(int16_t * buffer, int count);
+		template<uint8_t Format> inline int16_t getNextSample();
+		template<uint8_t Format> inline void advance();
+		template<uint8_t Format> void prime();
 };
 
 EnhancedSamplesGenerator::EnhancedSamplesGenerator(std::shared_ptr<AudioSample> sample)
-	: _sample(sample), repeatCount(0), index(0), blockIndex(0), frequency(0), previousSample(0), currentSample(0), samplesPerGet(1.0), fractionalSampleOffset(0.0)
+	: _sample(sample), repeatCount(0), frequency(0), history{ 0, 0, 0, 0 },
+	stepWhole(1), stepFraction(0), pendingSamples(0), fraction(0), interpolation(AUDIO_INTERPOLATION_LINEAR)
 {}
 
 void EnhancedSamplesGenerator::setFrequency(int value) {
 	frequency = value;
-	samplesPerGet = calculateSamplerate(value);
+	calculatePhaseStep();
 }
 
 void EnhancedSamplesGenerator::setSampleRate(int value) {
 	WaveformGenerator::setSampleRate(value);
-	samplesPerGet = calculateSamplerate(frequency);
+	calculatePhaseStep();
 }
 
-int EnhancedSamplesGenerator::getSample() {
+// Move on one sample
+template<uint8_t Format> inline void EnhancedSamplesGenerator::advance() {
+	history[0] = history[1];
+	history[1] = history[2];
+	history[2] = history[3];
+	history[3] = getNextSample<Format>();
+}
+
+void EnhancedSamplesGenerator::renderBlock(int16_t * buffer, int count) {
 	if (duration() == 0) {
-		return 0;
+		memset(buffer, 0, count * sizeof(int16_t));
+		return;
 	}
 
-	// if we've moved far enough along, read the next sample
-	while (fractionalSampleOffset >= 1.0) {
-		previousSample = currentSample;
-		currentSample = getNextSample();
-		fractionalSampleOffset = fractionalSampleOffset - 1.0;
+	// the sample's format is fixed, so it's checked here once per block rather than for every sample read
+	switch (_sample->format) {
+		case AUDIO_FORMAT_16BIT_SIGNED:
+			renderSamples<AUDIO_FORMAT_16BIT_SIGNED>(buffer, count);
+			break;
+		case AUDIO_FORMAT_ADPCM:
+			renderSamples<AUDIO_FORMAT_ADPCM>(buffer, count);
+			break;
+		default:
+			renderSamples<AUDIO_FORMAT_8BIT_SIGNED>(buffer, count);
+			break;
 	}
+}
 
-	 // Interpolate between the samples to reduce aliasing
-	int sample = currentSample * fractionalSampleOffset + previousSample * (1.0-fractionalSampleOffset);
-
-	fractionalSampleOffset = fractionalSampleOffset + samplesPerGet;
-
-	// process volume
-	sample = sample * volume() / 127;
-
-	decDuration();
-
-	return sample;
+template<uint8_t Format> void EnhancedSamplesGenerator::renderSamples(int16_t * buffer, int count) {
+	auto volume = this->volume();
+	for (int i = 0; i < count; i++) {
+		// if we've moved far enough along, read the next sample
+		while (pendingSamples) {
+			advance<Format>();
+			pendingSamples--;
+		}
+
+		int sample;
+		if (interpolation == AUDIO_INTERPOLATION_HERMITE) {
+			int32_t t = fraction >> 16;
+			// coefficients are doubled to keep them whole
+			int32_t p0 = history[0], p1 = history[1], p2 = history[2], p3 = history[3];
+			int32_t c1 = p2 - p0;
+			int32_t c2 = 2 * p0 - 5 * p1 + 4 * p2 - p3;
+			int32_t c3 = (p3 - p0) + 3 * (p1 - p2);
+			// evaluate the curve with 16 fractional bits, rounding once at the end
+			int64_t curve = (int64_t)c3 * t;
+			curve = ((curve + (int64_t)c2 * 65536) * t) >> 16;
+			curve = ((curve + (int64_t)c1 * 65536) * t) >> 16;
+			sample = p1 + (int32_t)((curve + (1 << 16)) >> 17);
+			sample = std::min(std::max(sample, -32768), 32767);
+		} else {
+			// Interpolate between the samples to reduce aliasing
+			// this uses the whole fraction, and truncates towards zero, as the old double-precision code did
+			int64_t mix = (int64_t)history[2] * fraction + (int64_t)history[1] * ((1LL << 32) - fraction);
+			sample = (mix + (mix < 0 ? 0xFFFFFFFFLL : 0)) >> 32;
+		}
+
+		uint32_t previousFraction = fraction;
+		fraction += stepFraction;
+		pendingSamples = stepWhole + (fraction < previousFraction);
+
+		// process volume, scaling down to 8 bits
+		buffer[i] = applyVolume(sample, volume) / 256;
+	}
 }
 
 int EnhancedSamplesGenerator::getDuration(uint16_t frequency) {
 	// TODO this will produce an incorrect duration if the sample rate for the channel has been
 	// adjusted to differ from the underlying audio system sample rate
 	// At this point it's not clear how to resolve this, so we'll assume it hasn't been adjusted
-	return !_sample ? 0 : (_sample->getSize() * 1000 / sampleRate()) / calculateSamplerate(frequency);
+	// As in calculatePhaseStep, there's no duration to give until there's a rate to play at
+	if (!_sample || sampleRate() == 0) {
+		return 0;
+	}
+	auto rate = calculateSamplerate(frequency);
+	return rate > 0 ? (_sample->getSize() * 1000 / sampleRate()) / rate : 0;
 }
 
 void EnhancedSamplesGenerator::seekTo(uint32_t position) {
-	_sample->seekTo(position, index, blockIndex, repeatCount);
+	_sample->seekTo(position, cursor, repeatCount);
 
 	// prepare our fractional sample data for playback
-	fractionalSampleOffset = 0.0;
-	previousSample = _sample->getSample(index, blockIndex);
-	currentSample = _sample->getSample(index, blockIndex);
+	fraction = 0;
+	pendingSamples = 0;
+	switch (_sample->format) {
+		case AUDIO_FORMAT_16BIT_SIGNED:
+			prime<AUDIO_FORMAT_16BIT_SIGNED>();
+			break;
+		case AUDIO_FORMAT_ADPCM:
+			prime<AUDIO_FORMAT_ADPCM>();
+			break;
+		default:
+			prime<AUDIO_FORMAT_8BIT_SIGNED>();
+			break;
+	}
+}
+
+// Fill the history from the current position
+template<uint8_t Format> void EnhancedSamplesGenerator::prime() {
+	history[1] = getNextSample<Format>();
+	history[0] = history[1];
+	history[2] = getNextSample<Format>();
+	history[3] = getNextSample<Format>();
 }
 
 double EnhancedSamplesGenerator::calculateSamplerate(uint16_t frequency) {
@@ -102,14 +185,27 @@ double EnhancedSamplesGenerator::calculateSamplerate(uint16_t frequency) {
 	return frequencyAdjust * ((double)_sample->sampleRate / (double)(sampleRate()));
 }
 
-int8_t EnhancedSamplesGenerator::getNextSample() {
-	auto sample = _sample->getSample(index, blockIndex);
+// Work out the phase step from the sample's rate and base frequency, in integer arithmetic
+// step = (frequency / baseFrequency) * (sampleRate / output rate)
+void EnhancedSamplesGenerator::calculatePhaseStep() {
+	auto baseFrequency = _sample->baseFrequency;
+	uint64_t numerator = (uint64_t)_sample->sampleRate * (baseFrequency > 0 ? frequency : 1);
+	uint64_t denominator = (uint64_t)sampleRate() * (baseFrequency > 0 ? baseFrequency : 1);
+	if (denominator == 0) {
+		return;
+	}
+	stepWhole = numerator / denominator;
+	stepFraction = ((numerator % denominator) << 32) / denominator;
+}
+
+template<uint8_t Format> inline int16_t EnhancedSamplesGenerator::getNextSample() {
+	auto sample = _sample->getSample<Format>(cursor);
 
 	// looping magic
 	repeatCount--;
 	if (repeatCount == 0) {
-		// we've reached the end of the repeat section, so loop back
-		seekTo(_sample->repeatStart);
+		// we've reached the end of the repeat section, so carry on reading from the repeat start
+		_sample->seekTo(_sample->repeatStart, cursor, repeatCount);
 	}
 
 	return sample;
@@ -15,6 +15,7 @@ class ADSRVolumeEnvelope : public VolumeEnvelope {
 		uint8_t getVolume(uint8_t baseVolume, uint32_t elapsed, int32_t duration);
 		bool isReleasing(uint32_t elapsed, int32_t duration);
 		bool isFinished(uint32_t elapsed, int32_t duration);
+		VolumeRamp getRamp(uint8_t baseVolume, uint32_t elapsed, int32_t duration);
 		uint32_t getRelease() {
 			return this->_release;
 		}
@@ -51,7 +52,7 @@ uint8_t ADSRVolumeEnvelope::getVolume(uint8_t baseVolume, uint32_t elapsed, int3
 	phaseTime -= this->_decay;
 	int32_t sustainDuration = duration < 0 ? elapsed : duration - (this->_attack + this->_decay);
 	if (sustainDuration < 0) sustainDuration = 0;
-	if (phaseTime < sustainDuration) {
+	if (phaseTime < (uint32_t)sustainDuration) {
 		return sustainVolume;
 	}
 	phaseTime -= sustainDuration;
@@ -66,7 +67,7 @@ bool ADSRVolumeEnvelope::isReleasing(uint32_t elapsed, int32_t duration) {
 	auto minDuration = this->_attack + this->_decay;
 	if (duration < minDuration) duration = minDuration;
 
-	return (elapsed >= duration);
+	return (elapsed >= (uint32_t)duration);
 }
 
 bool ADSRVolumeEnvelope::isFinished(uint32_t elapsed, int32_t duration) {
@@ -74,7 +75,31 @@ bool ADSRVolumeEnvelope::isFinished(uint32_t elapsed, int32_t duration) {
 	auto minDuration = this->_attack + this->_decay;
 	if (duration < minDuration) duration = minDuration;
 
-	return (elapsed >= duration + this->_release);
+	return (elapsed >= (uint32_t)duration + this->_release);
+}
+
+VolumeRamp ADSRVolumeEnvelope::getRamp(uint8_t baseVolume, uint32_t elapsed, int32_t duration) {
+	// each phase is a straight line, matching getVolume
+	uint8_t sustainVolume = baseVolume * this->_sustain / 127;
+	uint32_t sustainStart = this->_attack + this->_decay;
+	if (elapsed < this->_attack) {
+		return { 0, this->_attack, 0, baseVolume };
+	}
+	if (elapsed < sustainStart) {
+		return { this->_attack, sustainStart, baseVolume, sustainVolume };
+	}
+	if (duration < 0) {
+		// sustain forever
+		return { sustainStart, UINT32_MAX, sustainVolume, sustainVolume };
+	}
+	uint32_t releaseStart = (uint32_t)duration < sustainStart ? sustainStart : (uint32_t)duration;
+	if (elapsed < releaseStart) {
+		return { sustainStart, releaseStart, sustainVolume, sustainVolume };
+	}
+	if (elapsed < releaseStart + this->_release) {
+		return { releaseStart, releaseStart + this->_release, sustainVolume, 0 };
+	}
+	return { releaseStart + this->_release, UINT32_MAX, 0, 0 };
 }
 
 #endif // ENVELOPE_ADSR_H
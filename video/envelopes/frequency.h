@@ -22,6 +22,7 @@ class SteppedFrequencyEnvelope : public FrequencyEnvelope {
 		SteppedFrequencyEnvelope(std::shared_ptr<std::vector<FrequencyStepPhase>> phases, uint16_t stepLength, bool repeats, bool cumulative, bool restrict);
 		uint16_t getFrequency(uint16_t baseFrequency, uint32_t elapsed, int32_t duration);
 		bool isFinished(uint32_t elapsed, int32_t duration);
+		uint32_t getNextChange(uint32_t elapsed, int32_t duration);
 	private:
 		std::shared_ptr<std::vector<FrequencyStepPhase>> _phases;
 		uint16_t _stepLength;
@@ -99,4 +100,15 @@ bool SteppedFrequencyEnvelope::isFinished(uint32_t elapsed, int32_t duration) {
 	return elapsed >= _totalLength;
 }
 
+uint32_t SteppedFrequencyEnvelope::getNextChange(uint32_t elapsed, int32_t duration) {
+	// frequency only changes at the start of each step
+	if (!_repeats && elapsed >= _totalLength) {
+		return UINT32_MAX;
+	}
+	if (_stepLength == 0) {
+		return elapsed + 1;
+	}
+	return (elapsed / _stepLength + 1) * _stepLength;
+}
+
 #endif // ENVELOPE_FREQUENCY_H
@@ -24,6 +24,7 @@ class MultiphaseADSREnvelope : public VolumeEnvelope {
 		uint8_t		getVolume(uint8_t baseVolume, uint32_t elapsed, int32_t duration);
 		bool		isReleasing(uint32_t elapsed, int32_t duration);
 		bool 		isFinished(uint32_t elapsed, int32_t duration);
+		VolumeRamp	getRamp(uint8_t baseVolume, uint32_t elapsed, int32_t duration);
 		uint32_t	getRelease() {
 			return _releaseDuration;
 		};
@@ -112,7 +113,8 @@ uint8_t MultiphaseADSREnvelope::getVolume(uint8_t baseVolume, uint32_t elapsed,
 	auto sustainVolume = getTargetVolume(baseVolume, _sustainLevel);
 	if (_sustainLoops) {
 		// if we have sustain data, and it's not just zero duration, then loop around it
-		while (pos < duration) {
+		// a duration of -1 compares as the largest value, so sustain loops forever
+		while (pos < (uint32_t)duration) {
 			// short-cut looping sub-phases if we can for complete loops
 			if (subPhasePos > _sustainDuration) {
 				subPhasePos -= _sustainDuration;
@@ -130,12 +132,12 @@ uint8_t MultiphaseADSREnvelope::getVolume(uint8_t baseVolume, uint32_t elapsed,
 				}
 			}
 		}
-	} else if (elapsed < duration) {
+	} else if (elapsed < (uint32_t)duration) {
 		// non-looping sustain - so we're spreading time between the phases, if there are any
 		if (_sustainSubphases <= 1) {
 			return map(subPhasePos, 0, duration - _attackDuration, startVolume, sustainVolume);
 		}
-		int phaseDuration = (duration - _attackDuration) / _sustainSubphases;
+		uint32_t phaseDuration = (duration - _attackDuration) / _sustainSubphases;
 		for (auto subPhase : *this->_sustain) {
 			if (subPhasePos < phaseDuration) {
 				// we're in this subphase
@@ -166,12 +168,12 @@ uint8_t MultiphaseADSREnvelope::getVolume(uint8_t baseVolume, uint32_t elapsed,
 bool MultiphaseADSREnvelope::isReleasing(uint32_t elapsed, int32_t duration) {
 	if (duration < 0) return false;
 	auto minDuration = this->_attackDuration;
-	if (duration < minDuration) duration = minDuration;
+	if ((uint32_t)duration < minDuration) duration = minDuration;
 
 	// NB this is an approximation.  we may not actually be using "release" phase of envelope
 	// but we'll consider ourselves to be in the "release" if the following check is true
 	// this is good enough for the channel state machine, as the isFinished check is correct
-	return (elapsed >= duration);
+	return (elapsed >= (uint32_t)duration);
 }
 
 bool MultiphaseADSREnvelope::isFinished(uint32_t elapsed, int32_t duration) {
@@ -180,16 +182,86 @@ bool MultiphaseADSREnvelope::isFinished(uint32_t elapsed, int32_t duration) {
 	// we're finished if we have reached the end of sustain and then end of release
 	auto minDuration = _attackDuration + _sustainDuration;
 	if (_sustainDuration != 0) {
-		while ((minDuration + _sustainDuration) <= duration) {
+		while ((minDuration + _sustainDuration) <= (uint32_t)duration) {
 			minDuration += _sustainDuration;
 		}
 	}
 
-	if (duration < minDuration) duration = minDuration;
+	if ((uint32_t)duration < minDuration) duration = minDuration;
 
 	return (elapsed >= duration + this->_releaseDuration);
 }
 
+VolumeRamp MultiphaseADSREnvelope::getRamp(uint8_t baseVolume, uint32_t elapsed, int32_t duration) {
+	// each sub-phase is a straight line, so this follows the same path through them as getVolume
+	uint32_t pos = 0;
+	uint8_t startVolume = 0;
+	if (elapsed < _attackDuration) {
+		for (const auto& subPhase : *this->_attack) {
+			auto targetVolume = getTargetVolume(baseVolume, subPhase.level);
+			if (elapsed < pos + subPhase.duration) {
+				return { pos, pos + subPhase.duration, startVolume, targetVolume };
+			}
+			pos += subPhase.duration;
+			startVolume = targetVolume;
+		}
+	}
+	pos = _attackDuration;
+	startVolume = getTargetVolume(baseVolume, _attackLevel);
+
+	auto sustainVolume = getTargetVolume(baseVolume, _sustainLevel);
+	if (_sustainLoops) {
+		// a duration of -1 compares as the largest value, so sustain loops forever
+		while (pos < (uint32_t)duration) {
+			if (elapsed - pos > _sustainDuration) {
+				// skip whole loops
+				pos += _sustainDuration;
+				startVolume = sustainVolume;
+				continue;
+			}
+			for (const auto& subPhase : *this->_sustain) {
+				auto targetVolume = getTargetVolume(baseVolume, subPhase.level);
+				if (elapsed < pos + subPhase.duration) {
+					return { pos, pos + subPhase.duration, startVolume, targetVolume };
+				}
+				pos += subPhase.duration;
+				startVolume = targetVolume;
+			}
+		}
+	} else if (duration < 0) {
+		// with no duration there's no time to spread the sustain sub-phases over, so hold the attack level
+		return { pos, UINT32_MAX, startVolume, startVolume };
+	} else if (elapsed < (uint32_t)duration) {
+		// non-looping sustain spreads the time until release between the sub-phases
+		if (_sustainSubphases <= 1) {
+			return { pos, (uint32_t)duration, startVolume, sustainVolume };
+		}
+		uint32_t phaseDuration = (duration - _attackDuration) / _sustainSubphases;
+		for (const auto& subPhase : *this->_sustain) {
+			auto targetVolume = getTargetVolume(baseVolume, subPhase.level);
+			if (elapsed < pos + phaseDuration) {
+				return { pos, pos + phaseDuration, startVolume, targetVolume };
+			}
+			pos += phaseDuration;
+			startVolume = targetVolume;
+		}
+		return { pos, (uint32_t)duration, startVolume, startVolume };
+	} else {
+		pos = duration;
+		startVolume = sustainVolume;
+	}
+
+	for (const auto& subPhase : *this->_release) {
+		auto targetVolume = getTargetVolume(baseVolume, subPhase.level);
+		if (elapsed < pos + subPhase.duration) {
+			return { pos, pos + subPhase.duration, startVolume, targetVolume };
+		}
+		pos += subPhase.duration;
+		startVolume = targetVolume;
+	}
+	return { pos, UINT32_MAX, 0, 0 };
+}
+
 uint8_t MultiphaseADSREnvelope::getTargetVolume(uint8_t baseVolume, uint8_t level) {
 	return baseVolume * level / 127;
 }
@@ -8,6 +8,16 @@
 #define ENVELOPE_TYPES_H
 
 #include <memory>
+#include <stdint.h>
+
+// A straight line section of a volume envelope, with times in milliseconds since the note started
+// An end of UINT32_MAX means the volume holds at startVolume from then on
+struct VolumeRamp {
+	uint32_t	start;
+	uint32_t	end;
+	uint8_t		startVolume;
+	uint8_t		endVolume;
+};
 
 class VolumeEnvelope {
 	public:
@@ -15,12 +25,20 @@ class VolumeEnvelope {
 		virtual bool isReleasing(uint32_t elapsed, int32_t duration) = 0;
 		virtual bool isFinished(uint32_t elapsed, int32_t duration) = 0;
 		virtual uint32_t getRelease() = 0;
+		// The section of the envelope playing at elapsed, which the channel follows sample by sample
+		// By default the volume is held for a millisecond at a time
+		virtual VolumeRamp getRamp(uint8_t baseVolume, uint32_t elapsed, int32_t duration) {
+			auto volume = getVolume(baseVolume, elapsed, duration);
+			return { elapsed, elapsed + 1, volume, volume };
+		}
 };
 
 class FrequencyEnvelope {
 	public:
 		virtual uint16_t getFrequency(uint16_t baseFrequency, uint32_t elapsed, int32_t duration) = 0;
 		virtual bool isFinished(uint32_t elapsed, int32_t duration) = 0;
+		// Time after elapsed at which the frequency may next change, or UINT32_MAX if it won't change again
+		virtual uint32_t getNextChange(uint32_t elapsed, int32_t duration) { return elapsed + 1; }
 };
 
 #endif // ENVELOPE_TYPES_H
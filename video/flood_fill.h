@@ -0,0 +1,198 @@
+#ifndef FLOOD_FILL_H
+#define FLOOD_FILL_H
+
+// Span-stack scanline flood fill
+//
+// Fills the 4-connected region containing a seed point, within a bounding rectangle.
+// The caller supplies:
+// - inside(x, y): whether a pixel belongs to the region being filled
+// - fillSpan(x1, x2, y): draws one horizontal span (x1 <= x2)
+//
+// Filled pixels are tracked in a 1bpp mask rather than by reading back the
+// framebuffer, as drawing may be queued, or use a paint mode (such as XOR) that
+// doesn't leave a predictable colour behind.
+//
+// Memory use is bounded: one bit per pixel of the bounding rectangle, plus a
+// fixed size seed stack.  If the stack overflows, seeds are dropped, and the
+// rows around them are remembered.  Once the stack empties only those rows are
+// rescanned to pick up unfilled pixels that sit directly above or below a
+// filled one, and a rescan that overflows again resumes where it stopped.
+//
+// Shapes that never hold more than FLOOD_FILL_STACK_SIZE pending runs, which
+// covers spirals and most mazes, fill in time proportional to the area.  In the
+// worst case, a shape with many more open runs per row than the stack holds
+// (such as a comb of single pixel teeth), each overflow costs a rescan of the
+// rows between its dropped seeds, so the total time is bounded by the area
+// multiplied by the number of overflows.
+//
+
+#include <algorithm>
+#include <stdint.h>
+#include <string.h>
+
+#include "types.h"
+
+#define FLOOD_FILL_STACK_SIZE	512		// Maximum number of pending seeds
+
+struct FloodFillSeed {
+	int16_t		x;
+	int16_t		y;
+};
+
+class FloodFill {
+	public:
+		FloodFill(int16_t x1, int16_t y1, int16_t x2, int16_t y2) :
+			left(x1), top(y1), width(x2 - x1 + 1), height(y2 - y1 + 1), stackSize(0),
+			overflowed(false), rescanTop(INT16_MAX), rescanBottom(INT16_MIN) {
+			rowBytes = (width + 7) >> 3;
+			mask = make_unique_psram_array<uint8_t>(rowBytes * height);
+			if (mask) {
+				memset(mask.get(), 0, rowBytes * height);
+			}
+		}
+
+		inline bool isValid() {
+			return mask != nullptr && width > 0 && height > 0;
+		}
+
+		template<typename Inside, typename FillSpan>
+		void fill(int16_t x, int16_t y, Inside inside, FillSpan fillSpan);
+
+	private:
+		int16_t		left;
+		int16_t		top;
+		int16_t		width;
+		int16_t		height;
+		int16_t		rowBytes;
+		std::unique_ptr<uint8_t[]> mask;
+		FloodFillSeed	stack[FLOOD_FILL_STACK_SIZE];
+		uint16_t	stackSize;
+		bool		overflowed;
+		int16_t		rescanTop;		// rows that may hold dropped seeds
+		int16_t		rescanBottom;
+
+		inline bool isFilled(int16_t x, int16_t y) {
+			auto mx = x - left;
+			return mask[(y - top) * rowBytes + (mx >> 3)] & (0x80 >> (mx & 7));
+		}
+
+		inline void markFilled(int16_t x1, int16_t x2, int16_t y) {
+			auto row = &mask[(y - top) * rowBytes];
+			for (auto mx = x1 - left; mx <= x2 - left; mx++) {
+				row[mx >> 3] |= (0x80 >> (mx & 7));
+			}
+		}
+
+		inline void push(int16_t x, int16_t y) {
+			if (stackSize < FLOOD_FILL_STACK_SIZE) {
+				stack[stackSize++] = { x, y };
+			} else {
+				overflowed = true;
+				// the seed is found again by scanning the filled row next to it
+				markRescan(y - 1, y + 1);
+			}
+		}
+
+		inline void markRescan(int16_t y1, int16_t y2) {
+			rescanTop = std::min(rescanTop, y1);
+			rescanBottom = std::max(rescanBottom, y2);
+		}
+
+		template<typename Inside>
+		inline bool fillable(int16_t x, int16_t y, Inside &inside) {
+			return !isFilled(x, y) && inside(x, y);
+		}
+
+		template<typename Inside>
+		void pushRuns(int16_t x1, int16_t x2, int16_t y, Inside &inside);
+
+		template<typename Inside>
+		void recoverSeeds(Inside &inside);
+};
+
+// Push one seed for each fillable run on row y between x1 and x2
+//
+template<typename Inside>
+void FloodFill::pushRuns(int16_t x1, int16_t x2, int16_t y, Inside &inside) {
+	if (y < top || y >= top + height) {
+		return;
+	}
+	bool inRun = false;
+	for (int16_t x = x1; x <= x2; x++) {
+		if (fillable(x, y, inside)) {
+			if (!inRun) {
+				push(x, y);
+				inRun = true;
+			}
+		} else {
+			inRun = false;
+		}
+	}
+}
+
+// Rescan the rows around dropped seeds for unfilled pixels next to filled ones
+//
+template<typename Inside>
+void FloodFill::recoverSeeds(Inside &inside) {
+	int16_t y1 = std::max(rescanTop, top);
+	int16_t y2 = std::min(rescanBottom, (int16_t)(top + height - 1));
+	overflowed = false;
+	rescanTop = INT16_MAX;
+	rescanBottom = INT16_MIN;
+	for (int16_t y = y1; y <= y2; y++) {
+		int16_t x = left;
+		while (x < left + width) {
+			if (!isFilled(x, y)) {
+				x++;
+				continue;
+			}
+			auto x1 = x;
+			while (x < left + width && isFilled(x, y)) {
+				x++;
+			}
+			pushRuns(x1, x - 1, y - 1, inside);
+			pushRuns(x1, x - 1, y + 1, inside);
+			if (overflowed) {
+				// stack is full again - process what we have, then carry on from this row
+				markRescan(y, y2);
+				return;
+			}
+		}
+	}
+}
+
+template<typename Inside, typename FillSpan>
+void FloodFill::fill(int16_t x, int16_t y, Inside inside, FillSpan fillSpan) {
+	if (!isValid() || x < left || x >= left + width || y < top || y >= top + height) {
+		return;
+	}
+	push(x, y);
+
+	while (stackSize > 0) {
+		while (stackSize > 0) {
+			auto seed = stack[--stackSize];
+			if (!fillable(seed.x, seed.y, inside)) {
+				continue;
+			}
+			// extend the span as far as it will go in each direction
+			auto x1 = seed.x;
+			auto x2 = seed.x;
+			while (x1 > left && fillable(x1 - 1, seed.y, inside)) {
+				x1--;
+			}
+			while (x2 < left + width - 1 && fillable(x2 + 1, seed.y, inside)) {
+				x2++;
+			}
+			markFilled(x1, x2, seed.y);
+			fillSpan(x1, x2, seed.y);
+
+			pushRuns(x1, x2, seed.y - 1, inside);
+			pushRuns(x1, x2, seed.y + 1, inside);
+		}
+		if (overflowed) {
+			recoverSeeds(inside);
+		}
+	}
+}
+
+#endif // FLOOD_FILL_H
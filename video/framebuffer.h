@@ -0,0 +1,142 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+// Direct framebuffer access
+// Reads pixels straight from the VGA controller's drawing buffer in its native format,
+// avoiding the per-pixel canvas->getPixel call and its conversion to RGB888.
+// The drawing queue must be flushed (waitPlotCompletion) before reading
+//
+
+#include <fabgl.h>
+
+#include "agon.h"
+#include "agon_palette.h"
+#include "agon_screen.h"
+#include "mem_helpers.h"
+
+// Accessor for the controller's viewport row pointers
+// The controller is never constructed as this type - it just gives us access to the protected members
+//
+class FramebufferAccessor : public fabgl::VGABaseController {
+	public:
+		static inline uint8_t * getRow(fabgl::VGABaseController * controller, int y) {
+			return (uint8_t *) static_cast<FramebufferAccessor *>(controller)->m_viewPort[y];
+		}
+};
+
+// Get a pointer to the start of a row in the current drawing buffer
+//
+inline uint8_t * getFramebufferRow(int y) {
+	return FramebufferAccessor::getRow(_VGAController.get(), y);
+}
+
+// Convert an RGB888 colour into the native pixel value for the current colour depth
+// Paletted modes store the palette index, 64 colour mode stores RGB222 (red in the low bits)
+//
+uint8_t getNativeColour(RGB888 colour) {
+	if (getVGAColourDepth() == 64) {
+		return (colour.R >> 6) | ((colour.G >> 6) << 2) | ((colour.B >> 6) << 4);
+	}
+	return getPaletteIndex(colour);
+}
+
+// Read a native pixel value from a framebuffer row
+// 64 colour mode pixels have their sync bits masked off
+//
+inline uint8_t getNativePixel(const uint8_t * row, int x, uint8_t depth) {
+	switch (depth) {
+		case 2:  return (row[x >> 3] >> (7 - (x & 7))) & 0x01;
+		case 4:  return (row[x >> 2] >> (6 - ((x & 3) << 1))) & 0x03;
+		case 8:  return (read32_unaligned(row + (x >> 3) * 3) >> (21 - (x & 7) * 3)) & 0x07;
+		case 16: return (row[x >> 1] >> ((x & 1) ? 0 : 4)) & 0x0F;
+		default: return row[x ^ 2] & 0x3F;
+	}
+}
+
+// Write a native pixel value to a framebuffer row
+// 64 colour mode pixels keep their sync bits
+//
+inline void setNativePixel(uint8_t * row, int x, uint8_t depth, uint8_t value) {
+	switch (depth) {
+		case 2: {
+			uint8_t bit = 0x80 >> (x & 7);
+			row[x >> 3] = value ? (row[x >> 3] | bit) : (row[x >> 3] & ~bit);
+		}	break;
+		case 4: {
+			auto shift = 6 - ((x & 3) << 1);
+			row[x >> 2] = (row[x >> 2] & ~(0x03 << shift)) | (value << shift);
+		}	break;
+		case 8: {
+			// 8 pixels in 3 bytes, read as a little-endian 24-bit value
+			auto group = row + (x >> 3) * 3;
+			auto shift = 21 - (x & 7) * 3;
+			uint32_t bits = group[0] | (group[1] << 8) | (group[2] << 16);
+			bits = (bits & ~(0x07 << shift)) | (value << shift);
+			group[0] = bits;
+			group[1] = bits >> 8;
+			group[2] = bits >> 16;
+		}	break;
+		case 16: {
+			auto shift = (x & 1) ? 0 : 4;
+			row[x >> 1] = (row[x >> 1] & ~(0x0F << shift)) | (value << shift);
+		}	break;
+		default:
+			row[x ^ 2] = (row[x ^ 2] & 0xC0) | value;
+			break;
+	}
+}
+
+// Scan along a framebuffer row from x towards limit (exclusive), while pixels are (or are not) the given native colour
+// Returns the x coordinate of the last pixel that passed, or limit if every pixel up to it passed
+// In all modes other than 8 colours pixels are packed in whole bytes, so runs are checked a 32-bit word at a time
+//
+int16_t scanFramebufferRow(const uint8_t * row, int16_t x, int16_t limit, int8_t direction, uint8_t colour, bool whileMatching) {
+	auto depth = getVGAColourDepth();
+	uint8_t bits = 0;
+	switch (depth) {
+		case 2:  bits = 1; break;
+		case 4:  bits = 2; break;
+		case 16: bits = 4; break;
+		case 64: bits = 8; break;
+	}
+
+	if (bits) {
+		// word-at-a-time scan
+		// lows has the bottom bit of each pixel field set, highs the top bit
+		const int16_t perWord = 32 / bits;
+		const uint32_t lows = 0xFFFFFFFF / ((1 << bits) - 1);
+		const uint32_t highs = lows << (bits - 1);
+		const uint32_t fieldMask = depth == 64 ? 0x3F3F3F3F : 0xFFFFFFFF;
+		const uint32_t pattern = colour * lows;
+
+		while (x != limit) {
+			bool wordAligned = direction > 0
+				? ((x & (perWord - 1)) == 0 && x + perWord <= limit)
+				: ((x & (perWord - 1)) == perWord - 1 && x - perWord >= limit);
+			if (wordAligned) {
+				// every field in v is zero where the pixel matches our colour
+				uint32_t v = (read32_aligned(row + (x / perWord) * 4) & fieldMask) ^ pattern;
+				bool passes = whileMatching ? (v == 0) : (((v - lows) & ~v & highs) == 0);
+				if (passes) {
+					x += direction * perWord;
+					continue;
+				}
+			}
+			if ((getNativePixel(row, x, depth) == colour) != whileMatching) {
+				return x - direction;
+			}
+			x += direction;
+		}
+		return limit;
+	}
+
+	while (x != limit) {
+		if ((getNativePixel(row, x, depth) == colour) != whileMatching) {
+			return x - direction;
+		}
+		x += direction;
+	}
+	return limit;
+}
+
+#endif // FRAMEBUFFER_H
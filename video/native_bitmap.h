@@ -0,0 +1,157 @@
+#ifndef NATIVE_BITMAP_H
+#define NATIVE_BITMAP_H
+
+// Native format bitmaps
+// Opaque bitmaps can be held in the pixel format of the current screen mode, so fabgl
+// can copy them straight to the screen without converting every pixel on every draw.
+// The native copy is converted from the bitmap's RGBA8888 source buffer, which is left as it is,
+// and is rebuilt lazily whenever the screen mode or palette has changed since it was last converted.
+//
+
+#include <algorithm>
+#include <climits>
+#include <memory>
+#include <unordered_map>
+#include <fabgl.h>
+
+#include "agon.h"
+#include "agon_palette.h"
+#include "agon_screen.h"
+#include "buffer_stream.h"
+#include "types.h"
+
+struct NativeBitmap {
+	std::shared_ptr<BufferStream>	source;		// RGBA8888 source pixels
+	std::unique_ptr<uint8_t[]>		pixels;		// Native pixels, one byte per pixel
+	uint16_t						version;	// Value of nativeColourVersion at last conversion
+};
+
+std::unordered_map<uint16_t, NativeBitmap> nativeBitmaps;	// Native copies of bitmaps, by bitmap ID
+uint16_t		nativeBitmapsVersion = 0;		// Value of nativeColourVersion when all native bitmaps were last updated
+
+// Check whether every RGBA8888 pixel is opaque, which to fabgl is any non-zero alpha
+//
+bool isOpaqueRGBA8888(const uint8_t * source, uint32_t pixelCount) {
+	for (uint32_t i = 0; i < pixelCount; i++, source += 4) {
+		if (source[3] == 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Pack RGBA8888 pixels down to RGBA2222
+// Alpha is kept non-zero for any pixel that had some alpha, as fabgl only treats zero alpha as transparent
+// Returns true if every pixel is opaque
+//
+bool packRGBA2222(const uint8_t * source, uint8_t * dest, uint32_t pixelCount) {
+	bool opaque = true;
+	for (uint32_t i = 0; i < pixelCount; i++, source += 4) {
+		uint8_t alpha = source[3] ? std::max(source[3] >> 6, 1) : 0;
+		opaque &= alpha != 0;
+		dest[i] = (source[0] >> 6) | ((source[1] >> 6) << 2) | ((source[2] >> 6) << 4) | (alpha << 6);
+	}
+	return opaque;
+}
+
+// Build a lookup table from RGB222 (red in the low bits) to native pixel values for the current mode
+// Paletted modes use the nearest palette entry
+//
+void buildNativeColourLUT(uint8_t lut[64]) {
+	auto depth = getVGAColourDepth();
+	if (depth == 64) {
+		for (uint8_t c = 0; c < 64; c++) {
+			lut[c] = c;
+		}
+		return;
+	}
+	for (uint8_t c = 0; c < 64; c++) {
+		int r = c & 0x03, g = (c >> 2) & 0x03, b = (c >> 4) & 0x03;
+		int bestDistance = INT_MAX;
+		for (uint8_t i = 0; i < depth; i++) {
+			// palette entries are indexes into colourLookup, in 00RRGGBB format
+			auto entry = palette[i];
+			int dr = ((entry >> 4) & 0x03) - r;
+			int dg = ((entry >> 2) & 0x03) - g;
+			int db = (entry & 0x03) - b;
+			int distance = dr * dr + dg * dg + db * db;
+			if (distance < bestDistance) {
+				bestDistance = distance;
+				lut[c] = i;
+				if (distance == 0) {
+					break;
+				}
+			}
+		}
+	}
+}
+
+void convertNativeBitmap(NativeBitmap &native) {
+	uint8_t lut[64];
+	buildNativeColourLUT(lut);
+	auto source = native.source->getBuffer();
+	auto pixels = native.pixels.get();
+	auto pixelCount = native.source->size() / 4;
+	for (uint32_t i = 0; i < pixelCount; i++, source += 4) {
+		pixels[i] = lut[(source[0] >> 6) | ((source[1] >> 6) << 2) | ((source[2] >> 6) << 4)];
+	}
+	native.version = nativeColourVersion;
+}
+
+// Create a native format bitmap from an opaque RGBA8888 buffer
+// Returns nullptr if the native copy couldn't be allocated, in which case the caller should use the source as-is
+//
+std::shared_ptr<Bitmap> createNativeBitmap(uint16_t bitmapId, std::shared_ptr<BufferStream> source, uint16_t width, uint16_t height) {
+	NativeBitmap native;
+	native.source = source;
+	native.pixels = make_unique_psram_array<uint8_t>(source->size() / 4);
+	if (!native.pixels) {
+		debug_log("createNativeBitmap: failed to allocate native pixels for bitmap %d\n\r", bitmapId);
+		return nullptr;
+	}
+	convertNativeBitmap(native);
+	auto bitmap = make_shared_psram<Bitmap>(width, height, native.pixels.get(), PixelFormat::Native);
+	if (bitmap) {
+		nativeBitmaps[bitmapId] = std::move(native);
+	}
+	return bitmap;
+}
+
+inline void clearNativeBitmap(uint16_t bitmapId) {
+	nativeBitmaps.erase(bitmapId);
+}
+
+inline void resetNativeBitmaps() {
+	nativeBitmaps.clear();
+}
+
+// Re-convert a native bitmap if the mode or palette has changed since it was converted
+//
+inline void updateNativeBitmap(uint16_t bitmapId) {
+	if (nativeBitmapsVersion == nativeColourVersion) {
+		return;
+	}
+	auto native = nativeBitmaps.find(bitmapId);
+	if (native != nativeBitmaps.end() && native->second.version != nativeColourVersion) {
+		// pixels may still be in use by a queued draw
+		waitPlotCompletion();
+		convertNativeBitmap(native->second);
+	}
+}
+
+// Re-convert all native bitmaps that are out of date, such as those used by sprites
+//
+void updateNativeBitmaps() {
+	if (nativeBitmapsVersion == nativeColourVersion) {
+		return;
+	}
+	waitPlotCompletion();
+	for (auto &native : nativeBitmaps) {
+		if (native.second.version != nativeColourVersion) {
+			convertNativeBitmap(native.second);
+		}
+	}
+	nativeBitmapsVersion = nativeColourVersion;
+}
+
+#endif // NATIVE_BITMAP_H
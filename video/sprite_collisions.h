@@ -0,0 +1,221 @@
+#ifndef SPRITE_COLLISIONS_H
+#define SPRITE_COLLISIONS_H
+
+// Sprite collision detection
+// Finds overlapping pairs among the active sprites, optionally checking that opaque pixels overlap.
+// A uniform grid is used as a broadphase, so only sprites sharing a grid cell are compared.
+// Pixel checks use a 1bpp opacity mask per bitmap, built on first use and then cached.
+//
+
+#include <algorithm>
+#include <memory>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+#include <fabgl.h>
+
+#include "agon.h"
+#include "agon_screen.h"
+#include "sprites.h"
+#include "types.h"
+
+#define COLLISION_GRID_SHIFT	5		// Grid cells are 32x32 pixels
+
+struct CollisionMask {
+	std::weak_ptr<Bitmap>		bitmap;		// Bitmap the mask was built from, to detect replaced bitmaps
+	uint16_t					rowBytes;
+	std::unique_ptr<uint8_t[]>	bits;		// One bit per pixel, MSB first, set where opaque
+};
+
+std::unordered_map<uint16_t, CollisionMask> collisionMasks;	// Cached masks, by bitmap ID
+
+// Is the pixel at (x, y) of a bitmap opaque?
+//
+inline bool isBitmapPixelOpaque(const Bitmap * bitmap, int x, int y) {
+	switch (bitmap->format) {
+		case PixelFormat::RGBA8888:
+			return bitmap->data[(y * bitmap->width + x) * 4 + 3] != 0;
+		case PixelFormat::RGBA2222:
+			return (bitmap->data[y * bitmap->width + x] & 0xC0) != 0;
+		case PixelFormat::Mask:
+			return (bitmap->data[y * ((bitmap->width + 7) >> 3) + (x >> 3)] >> (7 - (x & 7))) & 0x01;
+		default:
+			return true;
+	}
+}
+
+// Get the collision mask for a bitmap, building it if it's not cached or the bitmap has been replaced
+// Returns nullptr if the mask couldn't be allocated
+//
+const CollisionMask * getCollisionMask(uint16_t bitmapId) {
+	auto bitmap = getBitmap(bitmapId);
+	if (!bitmap) {
+		return nullptr;
+	}
+	auto cached = collisionMasks.find(bitmapId);
+	if (cached != collisionMasks.end()) {
+		if (cached->second.bitmap.lock() == bitmap) {
+			return &cached->second;
+		}
+		collisionMasks.erase(cached);
+	}
+
+	CollisionMask mask;
+	mask.bitmap = bitmap;
+	mask.rowBytes = (bitmap->width + 7) >> 3;
+	mask.bits = make_unique_psram_array<uint8_t>(mask.rowBytes * bitmap->height);
+	if (!mask.bits) {
+		debug_log("getCollisionMask: failed to allocate mask for bitmap %d\n\r", bitmapId);
+		return nullptr;
+	}
+	memset(mask.bits.get(), 0, mask.rowBytes * bitmap->height);
+	for (int y = 0; y < bitmap->height; y++) {
+		auto row = &mask.bits[y * mask.rowBytes];
+		for (int x = 0; x < bitmap->width; x++) {
+			if (isBitmapPixelOpaque(bitmap.get(), x, y)) {
+				row[x >> 3] |= 0x80 >> (x & 7);
+			}
+		}
+	}
+	auto &stored = collisionMasks[bitmapId];
+	stored = std::move(mask);
+	return &stored;
+}
+
+// Drop masks for bitmaps that no longer exist
+//
+void pruneCollisionMasks() {
+	for (auto it = collisionMasks.begin(); it != collisionMasks.end();) {
+		if (it->second.bitmap.expired()) {
+			it = collisionMasks.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+// Read 8 mask bits starting at an arbitrary bit offset in a row, with bits beyond the row end as zero
+//
+inline uint8_t getMaskByte(const uint8_t * row, uint16_t rowBytes, int bit) {
+	auto index = bit >> 3;
+	auto shift = bit & 7;
+	uint8_t high = row[index] << shift;
+	uint8_t low = (shift && index + 1 < rowBytes) ? row[index + 1] >> (8 - shift) : 0;
+	return high | low;
+}
+
+// Check whether the opaque pixels of two sprites overlap within an intersection rectangle
+//
+bool masksOverlap(const CollisionMask * maskA, const Rect &rectA, const CollisionMask * maskB, const Rect &rectB, const Rect &overlap) {
+	auto width = overlap.X2 - overlap.X1 + 1;
+	for (int y = overlap.Y1; y <= overlap.Y2; y++) {
+		auto rowA = &maskA->bits[(y - rectA.Y1) * maskA->rowBytes];
+		auto rowB = &maskB->bits[(y - rectB.Y1) * maskB->rowBytes];
+		for (int x = 0; x < width; x += 8) {
+			uint8_t a = getMaskByte(rowA, maskA->rowBytes, overlap.X1 - rectA.X1 + x);
+			uint8_t b = getMaskByte(rowB, maskB->rowBytes, overlap.X1 - rectB.X1 + x);
+			if (width - x < 8) {
+				// ignore bits past the end of the overlap
+				auto keep = (uint8_t)(0xFF << (8 - (width - x)));
+				a &= keep;
+			}
+			if (a & b) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+// Find all colliding pairs of visible active sprites
+// Each pair is added to the results as two sprite IDs, lowest first
+//
+void findSpriteCollisions(bool pixelAccurate, std::vector<uint8_t> &results) {
+	results.clear();
+	pruneCollisionMasks();
+
+	// gather the sprites that can collide
+	// per-sprite data is sized to the active sprites, and kept off the VDU task's stack
+	std::vector<uint8_t> candidates;
+	std::vector<Rect> rects(numsprites);
+	std::vector<const CollisionMask *> masks(numsprites, nullptr);
+	for (auto n = 0; n < numsprites; n++) {
+		auto sprite = getSprite(n);
+		if (!isSpriteOnScreen(sprite) || sprite->currentFrame >= spriteFrameIds[n].size()) {
+			continue;
+		}
+		rects[n] = getSpriteRect(sprite);
+		if (pixelAccurate) {
+			masks[n] = getCollisionMask(spriteFrameIds[n][sprite->currentFrame]);
+		}
+		candidates.push_back(n);
+	}
+	if (candidates.size() < 2) {
+		return;
+	}
+
+	// bucket sprites into grid cells, clamping off-screen areas to the edge cells
+	int gridW = ((canvasW - 1) >> COLLISION_GRID_SHIFT) + 1;
+	int gridH = ((canvasH - 1) >> COLLISION_GRID_SHIFT) + 1;
+	auto cellRange = [&](const Rect &rect, int &cx1, int &cy1, int &cx2, int &cy2) {
+		cx1 = std::min(std::max(rect.X1 >> COLLISION_GRID_SHIFT, 0), gridW - 1);
+		cy1 = std::min(std::max(rect.Y1 >> COLLISION_GRID_SHIFT, 0), gridH - 1);
+		cx2 = std::min(std::max(rect.X2 >> COLLISION_GRID_SHIFT, 0), gridW - 1);
+		cy2 = std::min(std::max(rect.Y2 >> COLLISION_GRID_SHIFT, 0), gridH - 1);
+	};
+	// counting sort into a flat list: count entries per cell, then fill
+	std::vector<uint32_t> cellStart(gridW * gridH + 1, 0);
+	for (auto n : candidates) {
+		int cx1, cy1, cx2, cy2;
+		cellRange(rects[n], cx1, cy1, cx2, cy2);
+		for (auto cy = cy1; cy <= cy2; cy++) {
+			for (auto cx = cx1; cx <= cx2; cx++) {
+				cellStart[cy * gridW + cx + 1]++;
+			}
+		}
+	}
+	for (size_t i = 1; i < cellStart.size(); i++) {
+		cellStart[i] += cellStart[i - 1];
+	}
+	std::vector<uint8_t> cellEntries(cellStart.back());
+	std::vector<uint32_t> cellFill(cellStart.begin(), cellStart.end() - 1);
+	for (auto n : candidates) {
+		int cx1, cy1, cx2, cy2;
+		cellRange(rects[n], cx1, cy1, cx2, cy2);
+		for (auto cy = cy1; cy <= cy2; cy++) {
+			for (auto cx = cx1; cx <= cx2; cx++) {
+				cellEntries[cellFill[cy * gridW + cx]++] = n;
+			}
+		}
+	}
+
+	// test pairs within each cell
+	// a pair sharing several cells is only reported from the cell holding the top-left of their overlap
+	for (auto cy = 0; cy < gridH; cy++) {
+		for (auto cx = 0; cx < gridW; cx++) {
+			auto cell = cy * gridW + cx;
+			for (auto i = cellStart[cell]; i < cellStart[cell + 1]; i++) {
+				auto a = cellEntries[i];
+				for (auto j = i + 1; j < cellStart[cell + 1]; j++) {
+					auto b = cellEntries[j];
+					if (!rects[a].intersects(rects[b])) {
+						continue;
+					}
+					auto overlap = rects[a].intersection(rects[b]);
+					int ox, oy, ox2, oy2;
+					cellRange(overlap, ox, oy, ox2, oy2);
+					if (ox != cx || oy != cy) {
+						continue;
+					}
+					if (pixelAccurate && masks[a] && masks[b] && !masksOverlap(masks[a], rects[a], masks[b], rects[b], overlap)) {
+						continue;
+					}
+					results.push_back(std::min(a, b));
+					results.push_back(std::max(a, b));
+				}
+			}
+		}
+	}
+}
+
+#endif // SPRITE_COLLISIONS_H
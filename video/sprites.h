@@ -2,6 +2,7 @@
 #define SPRITES_H
 
 #include <algorithm>
+#include <bitset>
 #include <limits>
 #include <memory>
 #include <type_traits>
@@ -12,14 +13,29 @@
 #include "agon.h"
 #include "agon_ps2.h"
 #include "agon_screen.h"
+#include "buffer_stream.h"
+#include "native_bitmap.h"
+#include "test_flags.h"
 
 std::unordered_map<uint16_t, std::shared_ptr<Bitmap>> bitmaps;	// Storage for our bitmaps
+std::unordered_map<uint16_t, std::shared_ptr<BufferStream>> bitmapBackings;	// Pixel storage owned by bitmaps (atlases and compact copies), by bitmap ID
 uint8_t			numsprites = 0;					// Number of sprites on stage
 uint8_t			current_sprite = 0;				// Current sprite number
 Sprite			sprites[MAX_SPRITES];			// Sprite object storage
 
-// track which sprites may be using a bitmap
-std::unordered_map<uint16_t, std::vector<uint8_t>> bitmapUsers;
+// Dirty rectangle tracking for sprite refreshes
+// With TEST_FLAG_SPRITE_DIRTY_RECTS set, a refresh only restores and redraws sprites
+// that have changed, or that overlap an area a changed sprite covered or now covers
+struct SpriteDirtyState {
+	bool	dirty = false;				// Changed since the last refresh
+	bool	drawn = false;				// Was on screen after the last refresh
+	Rect	drawnRect;					// Area covered after the last refresh
+};
+SpriteDirtyState	spriteDirty[MAX_SPRITES];
+
+// track which bitmaps each sprite uses for its frames, and which sprites use each bitmap
+std::vector<uint16_t>	spriteFrameIds[MAX_SPRITES];
+std::unordered_map<uint16_t, std::bitset<MAX_SPRITES>> bitmapUsers;
 
 std::unordered_map<uint16_t, fabgl::Cursor> cursors;	// Storage for our cursors
 uint16_t		mCursor = MOUSE_DEFAULT_CURSOR;	// Mouse cursor
@@ -27,6 +43,7 @@ uint16_t		mCursor = MOUSE_DEFAULT_CURSOR;	// Mouse cursor
 
 std::shared_ptr<Bitmap> getBitmap(uint16_t id) {
 	if (bitmaps.find(id) != bitmaps.end()) {
+		updateNativeBitmap(id);
 		return bitmaps[id];
 	}
 	return nullptr;
@@ -82,6 +99,8 @@ bool setMouseCursor(uint16_t cursor = mCursor) {
 
 void resetBitmaps() {
 	bitmaps.clear();
+	bitmapBackings.clear();
+	resetNativeBitmaps();
 	// this will only be used after resetting sprites, so we can clear the bitmapUsers list
 	bitmapUsers.clear();
 	cursors.clear();
@@ -102,21 +121,35 @@ inline uint8_t getCurrentSprite() {
 	return current_sprite;
 }
 
+inline void markSpriteDirty(uint8_t s = current_sprite) {
+	spriteDirty[s].dirty = true;
+}
+
+inline bool isSpriteOnScreen(Sprite * sprite) {
+	return sprite->visible && sprite->getFrame() != nullptr;
+}
+
+inline Rect getSpriteRect(Sprite * sprite) {
+	return Rect(sprite->x, sprite->y, sprite->x + sprite->getWidth() - 1, sprite->y + sprite->getHeight() - 1);
+}
+
 void clearSpriteFrames(uint8_t s = current_sprite) {
 	auto sprite = getSprite(s);
+	markSpriteDirty(s);
 	sprite->visible = false;
 	sprite->setFrame(0);
 	sprite->clearBitmaps();
-	// find all bitmaps used by this sprite and remove it from the list
-	for (auto bitmapUser : bitmapUsers) {
-		auto users = bitmapUser.second;
-		// remove all instances of this sprite from the users list
-		auto it = std::find(users.begin(), users.end(), s);
-		while (it != users.end()) {
-			users.erase(it);
-			it = std::find(users.begin(), users.end(), s);
+	// remove this sprite from the users of each bitmap it had as a frame
+	for (auto bitmapId : spriteFrameIds[s]) {
+		auto users = bitmapUsers.find(bitmapId);
+		if (users != bitmapUsers.end()) {
+			users->second.reset(s);
+			if (users->second.none()) {
+				bitmapUsers.erase(users);
+			}
 		}
 	}
+	spriteFrameIds[s].clear();
 }
 
 void clearBitmap(uint16_t b) {
@@ -124,15 +157,20 @@ void clearBitmap(uint16_t b) {
 		return;
 	}
 	bitmaps.erase(b);
+	bitmapBackings.erase(b);
+	clearNativeBitmap(b);
 
 	// find all sprites that had used this bitmap and clear their frames
-	if (bitmapUsers.find(b) != bitmapUsers.end()) {
-		auto users = bitmapUsers[b];
-		for (auto user : users) {
-			debug_log("clearBitmap: sprite %d can no longer use bitmap %d, so clearing sprite frames\n\r", user, b);
-			clearSpriteFrames(user);
+	auto usersIter = bitmapUsers.find(b);
+	if (usersIter != bitmapUsers.end()) {
+		// take a copy, as clearing frames updates the users list
+		auto users = usersIter->second;
+		for (auto user = 0; user < MAX_SPRITES; user++) {
+			if (users.test(user)) {
+				debug_log("clearBitmap: sprite %d can no longer use bitmap %d, so clearing sprite frames\n\r", user, b);
+				clearSpriteFrames(user);
+			}
 		}
-		bitmapUsers.erase(b);
 	}
 }
 
@@ -143,7 +181,9 @@ void addSpriteFrame(uint16_t bitmapId) {
 		debug_log("addSpriteFrame: bitmap %d not found\n\r", bitmapId);
 		return;
 	}
-	bitmapUsers[bitmapId].push_back(current_sprite);
+	bitmapUsers[bitmapId].set(current_sprite);
+	spriteFrameIds[current_sprite].push_back(bitmapId);
+	markSpriteDirty();
 	sprite->addBitmap(bitmap.get());
 }
 
@@ -161,6 +201,11 @@ void activateSprites(uint8_t n) {
 		} else {
 			_VGAController->removeSprites();
 		}
+		// the controller has a new sprite list, so nothing we recorded about what's on screen is valid
+		for (auto s = 0; s < MAX_SPRITES; s++) {
+			spriteDirty[s].dirty = true;
+			spriteDirty[s].drawn = false;
+		}
 	}
 }
 
@@ -170,17 +215,20 @@ inline bool hasActiveSprites() {
 
 void nextSpriteFrame() {
 	auto sprite = getSprite();
+	markSpriteDirty();
 	sprite->nextFrame();
 }
 
 void previousSpriteFrame() {
 	auto sprite = getSprite();
+	markSpriteDirty();
 	auto frame = sprite->currentFrame;
 	sprite->setFrame(frame ? frame - 1 : sprite->framesCount - 1);
 }
 
 void setSpriteFrame(uint8_t n) {
 	auto sprite = getSprite();
+	markSpriteDirty();
 	if (n < sprite->framesCount) {
 		sprite->setFrame(n);
 	}
@@ -188,27 +236,172 @@ void setSpriteFrame(uint8_t n) {
 
 void showSprite() {
 	auto sprite = getSprite();
+	markSpriteDirty();
 	sprite->visible = 1;
 }
 
 void hideSprite(uint8_t s = current_sprite) {
 	auto sprite = getSprite(s);
+	markSpriteDirty(s);
 	sprite->visible = 0;
 }
 
 void moveSprite(int x, int y) {
 	auto sprite = getSprite();
+	markSpriteDirty();
 	sprite->moveTo(x, y);
 }
 
 void moveSpriteBy(int x, int y) {
 	auto sprite = getSprite();
+	markSpriteDirty();
 	sprite->moveBy(x, y);
 }
 
+// Apply a packed array of sprite update records, as defined by SPRITE_UPDATE_RECORD_SIZE and flags
+// X and Y are signed 16-bit little-endian values.  A trailing partial record is ignored
+//
+void updateSprites(const uint8_t * data, uint32_t length) {
+	for (; length >= SPRITE_UPDATE_RECORD_SIZE; data += SPRITE_UPDATE_RECORD_SIZE, length -= SPRITE_UPDATE_RECORD_SIZE) {
+		auto flags = data[6];
+		if (flags == 0) {
+			continue;
+		}
+		auto sprite = getSprite(data[0]);
+		int16_t x = data[1] | (data[2] << 8);
+		int16_t y = data[3] | (data[4] << 8);
+		auto frame = data[5];
+
+		if (flags & SPRITE_UPDATE_MOVE_TO) {
+			sprite->moveTo(x, y);
+		} else if (flags & SPRITE_UPDATE_MOVE_BY) {
+			sprite->moveBy(x, y);
+		}
+		if ((flags & SPRITE_UPDATE_FRAME) && frame < sprite->framesCount) {
+			sprite->setFrame(frame);
+		}
+		if (flags & SPRITE_UPDATE_SHOW) {
+			sprite->visible = 1;
+		} else if (flags & SPRITE_UPDATE_HIDE) {
+			sprite->visible = 0;
+		}
+		markSpriteDirty(data[0]);
+	}
+}
+
+// Remember where each active sprite is after a refresh, and clear its dirty flag
+//
+void recordSpritesDrawn() {
+	for (auto n = 0; n < numsprites; n++) {
+		auto sprite = getSprite(n);
+		auto &state = spriteDirty[n];
+		state.dirty = false;
+		state.drawn = isSpriteOnScreen(sprite);
+		if (state.drawn) {
+			state.drawnRect = getSpriteRect(sprite);
+		}
+	}
+}
+
+// Refresh only the sprites that need it
+// fabgl restores and redraws every sprite that has allowDraw set, so sprites that are unaffected
+// have it cleared for the duration of the refresh, leaving them (and their saved backgrounds) untouched
+//
+void refreshDirtySprites() {
+	// dirty areas are where changed sprites were, and where they are now
+	std::vector<Rect> dirtyRects;
+	auto addDirtyRect = [&dirtyRects](Rect rect) {
+		// merge with any overlapping rectangles, repeating as the merged rectangle grows
+		for (auto it = dirtyRects.begin(); it != dirtyRects.end();) {
+			if (it->intersects(rect)) {
+				rect = rect.merge(*it);
+				dirtyRects.erase(it);
+				it = dirtyRects.begin();
+			} else {
+				++it;
+			}
+		}
+		dirtyRects.push_back(rect);
+	};
+
+	bool affected[MAX_SPRITES] = { false };
+	uint16_t affectedCount = 0;
+	auto markAffected = [&](uint8_t n) {
+		auto sprite = getSprite(n);
+		affected[n] = true;
+		affectedCount++;
+		if (spriteDirty[n].drawn) {
+			addDirtyRect(spriteDirty[n].drawnRect);
+		}
+		if (isSpriteOnScreen(sprite)) {
+			addDirtyRect(getSpriteRect(sprite));
+		}
+	};
+
+	for (auto n = 0; n < numsprites; n++) {
+		if (spriteDirty[n].dirty) {
+			markAffected(n);
+		}
+	}
+	if (affectedCount == 0) {
+		return;
+	}
+
+	// any sprite overlapping a dirty area must be restored and redrawn too,
+	// which may in turn grow the dirty area, so repeat until nothing changes
+	bool changed = true;
+	while (changed && affectedCount < numsprites) {
+		changed = false;
+		for (auto n = 0; n < numsprites; n++) {
+			if (affected[n]) {
+				continue;
+			}
+			auto &state = spriteDirty[n];
+			auto sprite = getSprite(n);
+			for (auto &rect : dirtyRects) {
+				if ((state.drawn && state.drawnRect.intersects(rect)) || (isSpriteOnScreen(sprite) && getSpriteRect(sprite).intersects(rect))) {
+					markAffected(n);
+					changed = true;
+					break;
+				}
+			}
+		}
+	}
+
+	if (affectedCount < numsprites) {
+		waitPlotCompletion();
+		for (auto n = 0; n < numsprites; n++) {
+			if (!affected[n]) {
+				getSprite(n)->allowDraw = false;
+			}
+		}
+		_VGAController->refreshSprites();
+		// the refresh runs in the background, so must complete before unaffected sprites are allowed to draw again
+		waitPlotCompletion();
+		for (auto n = 0; n < numsprites; n++) {
+			getSprite(n)->allowDraw = true;
+		}
+	} else {
+		_VGAController->refreshSprites();
+	}
+	recordSpritesDrawn();
+}
+
 void refreshSprites() {
 	if (numsprites) {
-		_VGAController->refreshSprites();
+		if (nativeBitmapsVersion != nativeColourVersion) {
+			// sprite frames may be re-converted, so everything must be redrawn
+			updateNativeBitmaps();
+			for (auto n = 0; n < numsprites; n++) {
+				markSpriteDirty(n);
+			}
+		}
+		if (isTestFlagSet(TEST_FLAG_SPRITE_DIRTY_RECTS) && !isDoubleBuffered()) {
+			refreshDirtySprites();
+		} else {
+			_VGAController->refreshSprites();
+			recordSpritesDrawn();
+		}
 	}
 }
 
@@ -238,6 +431,7 @@ void resetSprites() {
 
 void setSpritePaintMode(uint8_t mode) {
 	auto sprite = getSprite();
+	markSpriteDirty();
 	if (mode <= 7) {
 		sprite->paintOptions.mode = static_cast<fabgl::PaintMode>(mode);
 	}
@@ -0,0 +1,129 @@
+#ifndef TILE_MAP_H
+#define TILE_MAP_H
+
+// Tile map layer
+// A map of 8-bit tile indices held in a buffer, drawn through a tileset of bitmap IDs.
+// The map is drawn into the graphics viewport at a pixel scroll offset, wrapping at its edges.
+// When the offset changes the viewport contents are scrolled, so only newly exposed
+// columns and rows of tiles need to be drawn.
+//
+
+#include <memory>
+#include <fabgl.h>
+
+#include "agon.h"
+#include "buffers.h"
+#include "sprites.h"
+#include "types.h"
+
+class TileMap {
+	public:
+		// Set the map buffer, which holds width * height tile indices, row by row
+		inline void setMap(uint16_t bufferId, uint16_t width, uint16_t height) {
+			mapBuffer = bufferId;
+			mapWidth = width;
+			mapHeight = height;
+			invalidate();
+		}
+
+		// Set the tileset buffer, which holds a 16-bit bitmap ID for each tile index
+		inline void setTileset(uint16_t bufferId, uint16_t width, uint16_t height) {
+			tilesetBuffer = bufferId;
+			tileWidth = width;
+			tileHeight = height;
+			invalidate();
+		}
+
+		inline bool isValid() {
+			return mapWidth > 0 && mapHeight > 0 && tileWidth > 0 && tileHeight > 0;
+		}
+
+		// Forget what's on screen, so the next scroll redraws everything
+		inline void invalidate() {
+			drawn = false;
+		}
+
+		inline void setDrawn(const Rect &viewport) {
+			drawn = true;
+			drawnViewport = viewport;
+		}
+
+		// Whether the viewport currently shows the map, so it can be scrolled rather than redrawn
+		inline bool isDrawnIn(const Rect &viewport) {
+			return drawn && drawnViewport.X1 == viewport.X1 && drawnViewport.Y1 == viewport.Y1
+				&& drawnViewport.X2 == viewport.X2 && drawnViewport.Y2 == viewport.Y2;
+		}
+
+		void drawArea(const Rect &viewport, const Rect &area);
+
+		int16_t		scrollX = 0;				// Map pixel shown at the top left of the viewport
+		int16_t		scrollY = 0;
+
+	private:
+		uint16_t	mapBuffer = 65535;
+		uint16_t	mapWidth = 0;				// Map size, in tiles
+		uint16_t	mapHeight = 0;
+		uint16_t	tilesetBuffer = 65535;
+		uint16_t	tileWidth = 0;				// Tile size, in pixels
+		uint16_t	tileHeight = 0;
+		bool		drawn = false;
+		Rect		drawnViewport;
+
+		// Divide rounding towards negative infinity, so scrolling left of or above the map origin works
+		static inline int floorDiv(int a, int b) {
+			return (a >= 0) ? a / b : -((-a + b - 1) / b);
+		}
+
+		static inline int wrap(int a, int size) {
+			a %= size;
+			return a < 0 ? a + size : a;
+		}
+};
+
+TileMap		tileMap;							// The tile map layer
+
+// Draw the tiles covering an area of the viewport
+// The caller sets up the paint options, and restores the clipping rectangle afterwards
+//
+void TileMap::drawArea(const Rect &viewport, const Rect &area) {
+	auto mapIter = buffers.find(mapBuffer);
+	auto tilesetIter = buffers.find(tilesetBuffer);
+	if (mapIter == buffers.end() || mapIter->second.size() != 1 || tilesetIter == buffers.end() || tilesetIter->second.size() != 1) {
+		debug_log("tileMap: map %d or tileset %d missing, or not a single block\n\r", mapBuffer, tilesetBuffer);
+		return;
+	}
+	auto &map = mapIter->second[0];
+	auto &tileset = tilesetIter->second[0];
+	if (map->size() < (uint32_t)mapWidth * mapHeight) {
+		debug_log("tileMap: map buffer %d is too small for %dx%d tiles\n\r", mapBuffer, mapWidth, mapHeight);
+		return;
+	}
+	auto mapData = map->getBuffer();
+	auto tilesetData = tileset->getBuffer();
+	auto tileCount = tileset->size() / 2;
+
+	canvasState.setClippingRect(area);
+
+	// map pixel coordinates of the area's corners, and the tiles covering them
+	int firstCol = floorDiv(area.X1 - viewport.X1 + scrollX, tileWidth);
+	int lastCol = floorDiv(area.X2 - viewport.X1 + scrollX, tileWidth);
+	int firstRow = floorDiv(area.Y1 - viewport.Y1 + scrollY, tileHeight);
+	int lastRow = floorDiv(area.Y2 - viewport.Y1 + scrollY, tileHeight);
+
+	for (int row = firstRow; row <= lastRow; row++) {
+		auto mapRow = &mapData[wrap(row, mapHeight) * mapWidth];
+		int y = viewport.Y1 + row * tileHeight - scrollY;
+		for (int col = firstCol; col <= lastCol; col++) {
+			auto tile = mapRow[wrap(col, mapWidth)];
+			if (tile >= tileCount) {
+				continue;
+			}
+			auto bitmap = getBitmap(tilesetData[tile * 2] | (tilesetData[tile * 2 + 1] << 8));
+			if (bitmap) {
+				canvas->drawBitmap(viewport.X1 + col * tileWidth - scrollX, y, bitmap.get());
+			}
+		}
+	}
+}
+
+#endif // TILE_MAP_H
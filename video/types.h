@@ -36,6 +36,7 @@
 
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <optional>
 #include <memory>
 
@@ -202,5 +203,7 @@ float float16ToFloat32(uint16_t h) {
     fraction <<= 13;
 
     uint32_t f = sign | exponent | fraction;
-    return reinterpret_cast<float&>(f);
+    float result;
+    memcpy(&result, &f, sizeof(result));
+    return result;
 }
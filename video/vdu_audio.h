@@ -57,8 +57,8 @@ void VDUStreamProcessor::vdu_sys_audio() {
 			auto waveform = readByte_t();	if (waveform == -1) return;
 			auto sampleNum = 0;
 
-			if (waveform == AUDIO_WAVE_SAMPLE) {
-				// explit buffer number given for sample
+			if (waveform == AUDIO_WAVE_SAMPLE || waveform == AUDIO_WAVE_WAVETABLE) {
+				// explit buffer number given for sample or wavetable
 				sampleNum = readWord_t();	if (sampleNum == -1) return;
 			}
 
@@ -89,7 +89,7 @@ void VDUStreamProcessor::vdu_sys_audio() {
 				case AUDIO_SAMPLE_FROM_BUFFER: {
 					auto bufferId = readWord_t();	if (bufferId == -1) return;
 					auto format = readByte_t();		if (format == -1) return;
-					uint32_t sampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
+					int32_t sampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
 					if (format & AUDIO_FORMAT_WITH_RATE) {
 						sampleRate = readWord_t();	if (sampleRate == -1) return;
 					}
@@ -97,6 +97,17 @@ void VDUStreamProcessor::vdu_sys_audio() {
 					sendAudioStatus(channel, createSampleFromBuffer(bufferId, format, sampleRate));
 				}	break;
 
+				case AUDIO_SAMPLE_STREAM_FROM_BUFFER: {
+					auto bufferId = readWord_t();	if (bufferId == -1) return;
+					auto format = readByte_t();		if (format == -1) return;
+					int32_t sampleRate = AUDIO_DEFAULT_SAMPLE_RATE;
+					if (format & AUDIO_FORMAT_WITH_RATE) {
+						sampleRate = readWord_t();	if (sampleRate == -1) return;
+					}
+
+					sendAudioStatus(channel, createSampleFromBuffer(bufferId, format, sampleRate, true));
+				}	break;
+
 				case AUDIO_SAMPLE_SET_FREQUENCY: {
 					auto frequency = readWord_t();	if (frequency == -1) return;
 
@@ -154,7 +165,11 @@ void VDUStreamProcessor::vdu_sys_audio() {
 					debug_log("  base frequency: %d\n\r", sample->baseFrequency);
 					debug_log("  repeat start: %d\n\r", sample->repeatStart);
 					debug_log("  repeat length: %d\n\r", sample->repeatLength);
-					if (buffer.size() > 0) {
+					if (sample->isStream()) {
+						debug_log("  stream low: %d\n\r", sample->isStreamLow());
+						debug_log("  stream underruns: %d\n\r", sample->getUnderruns());
+					}
+					if (buffer.size() > 0 && buffer[0]) {
 						debug_log("  data first byte: %d\n\r", buffer[0]->getBuffer()[0]);
 					}
 				} break;
@@ -227,6 +242,52 @@ void VDUStreamProcessor::vdu_sys_audio() {
 
 			sendAudioStatus(channel, setParameter(channel, param, value));
 		}	break;
+
+		case AUDIO_CMD_SEQUENCER: {
+			auto action = readByte_t();		if (action == -1) return;
+
+			switch (action) {
+				case AUDIO_SEQUENCER_LOAD: {
+					auto bufferId = readWord_t();	if (bufferId == -1) return;
+
+					sendAudioStatus(channel, loadSequence(channel, bufferId));
+				}	break;
+
+				case AUDIO_SEQUENCER_START: {
+					sendAudioStatus(channel, audioMixer.sequencer.start());
+				}	break;
+
+				case AUDIO_SEQUENCER_STOP: {
+					sendAudioStatus(channel, audioMixer.sequencer.stop());
+				}	break;
+
+				case AUDIO_SEQUENCER_TEMPO: {
+					auto tempo = readByte_t();		if (tempo == -1) return;
+
+					sendAudioStatus(channel, audioMixer.sequencer.setTempo(tempo));
+				}	break;
+
+				case AUDIO_SEQUENCER_SET_POSITION: {
+					auto order = readByte_t();		if (order == -1) return;
+					auto row = readByte_t();		if (row == -1) return;
+
+					sendAudioStatus(channel, audioMixer.sequencer.setPosition(order, row));
+				}	break;
+
+				case AUDIO_SEQUENCER_GET_ORDER: {
+					sendAudioStatus(channel, audioMixer.sequencer.getOrder());
+				}	break;
+
+				case AUDIO_SEQUENCER_GET_ROW: {
+					sendAudioStatus(channel, audioMixer.sequencer.getRow());
+				}	break;
+
+				default: {
+					debug_log("vdu_sys_audio: unknown sequencer action %d\n\r", action);
+					sendAudioStatus(channel, 0);
+				}
+			}
+		}	break;
 	}
 }
 
@@ -256,19 +317,28 @@ uint8_t VDUStreamProcessor::loadSample(uint16_t bufferId, uint32_t length) {
 
 // Create a sample from a buffer
 //
-uint8_t VDUStreamProcessor::createSampleFromBuffer(uint16_t bufferId, uint8_t format, uint16_t sampleRate) {
-	if (buffers.find(bufferId) == buffers.end()) {
+// Streams start with whatever is in the buffer, and take over any data written to it afterwards
+//
+uint8_t VDUStreamProcessor::createSampleFromBuffer(uint16_t bufferId, uint8_t format, uint16_t sampleRate, bool stream) {
+	if (!stream && buffers.find(bufferId) == buffers.end()) {
 		debug_log("vdu_sys_audio: buffer %d not found\n\r", bufferId);
 		return 0;
 	}
+	if ((format & AUDIO_FORMAT_DATA_MASK) > AUDIO_FORMAT_ADPCM) {
+		debug_log("vdu_sys_audio: unknown sample format %d\n\r", format & AUDIO_FORMAT_DATA_MASK);
+		return 0;
+	}
 	clearSample(bufferId);
-	auto sample = (format & AUDIO_FORMAT_WITH_RATE) ?
-		std::make_shared<AudioSample>(buffers[bufferId], format & AUDIO_FORMAT_DATA_MASK, sampleRate)
-		: std::make_shared<AudioSample>(buffers[bufferId], format & AUDIO_FORMAT_DATA_MASK);
+	auto sample = std::make_shared<AudioSample>(buffers[bufferId], format & AUDIO_FORMAT_DATA_MASK,
+		(format & AUDIO_FORMAT_WITH_RATE) ? sampleRate : AUDIO_DEFAULT_SAMPLE_RATE, 0, stream);
 	if (sample) {
 		if (format & AUDIO_FORMAT_TUNEABLE) {
 			sample->baseFrequency = AUDIO_DEFAULT_FREQUENCY;
 		}
+		if (stream) {
+			// the stream now holds the buffer's data
+			buffers.erase(bufferId);
+		}
 		samples[bufferId] = sample;
 		return 1;
 	}
@@ -391,4 +461,19 @@ uint8_t VDUStreamProcessor::setParameter(uint8_t channel, uint8_t parameter, uin
 	return 0;
 }
 
+// Load a song for the sequencer from a buffer, to play from the given channel
+//
+uint8_t VDUStreamProcessor::loadSequence(uint8_t channel, uint16_t bufferId) {
+	if (buffers.find(bufferId) == buffers.end()) {
+		debug_log("vdu_sys_audio: buffer %d not found\n\r", bufferId);
+		return 0;
+	}
+	// the sequencer keeps its own copy, so the buffer can be changed or cleared whilst playing
+	std::vector<uint8_t> data;
+	for (auto &block : buffers[bufferId]) {
+		data.insert(data.end(), block->getBuffer(), block->getBuffer() + block->size());
+	}
+	return audioMixer.sequencer.load(std::move(data), channel);
+}
+
 #endif // VDU_AUDIO_H
@@ -9,6 +9,7 @@
 #include <mat.h>
 #include <dspm_mult.h>
 
+#include "affine_blit.h"
 #include "agon.h"
 #include "agon_fonts.h"
 #include "buffers.h"
@@ -255,6 +256,13 @@ uint32_t VDUStreamProcessor::bufferWrite(uint16_t bufferId, uint32_t length) {
 		return remaining;
 	}
 
+	if (appendToSampleStream(bufferId, bufferStream)) {
+		// streamed samples take their data as it arrives, so it isn't kept in the buffer
+		debug_log("bufferWrite: streamed %d bytes to sample %d\n\r", length, bufferId);
+		return remaining;
+	}
+
+	clearAffineTransform(bufferId);
 	buffers[bufferId].push_back(std::move(bufferStream));
 	debug_log("bufferWrite: stored stream in buffer %d, length %d, %d streams stored\n\r", bufferId, length, buffers[bufferId].size());
 	return remaining;
@@ -320,6 +328,7 @@ void VDUStreamProcessor::bufferRemoveUsers(uint16_t bufferId) {
 	clearBitmap(bufferId);
 	clearFont(bufferId);
 	clearSample(bufferId);
+	clearAffineTransform(bufferId);
 }
 
 // VDU 23, 0, &A0, bufferId; 2: Clear buffer
@@ -336,6 +345,7 @@ void VDUStreamProcessor::bufferClear(uint16_t bufferId) {
 		context->resetCharToBitmap();
 		resetFonts();
 		resetSamples();
+		resetAffineTransforms();
 		return;
 	}
 	auto bufferIter = buffers.find(bufferId);
@@ -9,6 +9,8 @@
 #include "types.h"
 #include "vdu_stream_processor.h"
 
+#define MAX_SPARE_CONTEXTS		8		// Popped contexts kept for reuse
+
 void VDUStreamProcessor::vdu_sys_context() {
 	auto command = readByte_t(); if (command == -1) return;
 
@@ -127,7 +129,7 @@ bool VDUStreamProcessor::resetContext(uint8_t flags) {
 void VDUStreamProcessor::saveContext() {
 	debug_log("saveContext: saving context\n\r");
 	// create a new context and push it to the stack
-	auto newContext = make_shared_psram<Context>(*(context.get()));
+	auto newContext = copyContext(*context);
 	contextStack->push_back(newContext);
 	context = newContext;
 }
@@ -135,9 +137,11 @@ void VDUStreamProcessor::saveContext() {
 void VDUStreamProcessor::restoreContext() {
 	if (contextStack->size() > 1) {
 		debug_log("restoreContext: restoring context\n\r");
+		auto popped = std::move(contextStack->back());
 		contextStack->pop_back();
 		context = contextStack->back();
 		context->activate();
+		recycleContext(std::move(popped));
 	} else {
 		debug_log("restoreContext: no context to restore\n\r");
 	}
@@ -148,7 +152,7 @@ void VDUStreamProcessor::saveAndSelectContext(uint8_t id) {
 	if (contextExists(id)) {
 		// grab a copy of the top-most context at id
 		debug_log("saveAndSelectContext: selecting existing context %d\n\r", id);
-		context = make_shared_psram<Context>(*contextStacks[id]->back());
+		context = copyContext(*contextStacks[id]->back());
 		contextStack->push_back(context);
 		context->activate();
 	} else {
@@ -162,8 +166,10 @@ void VDUStreamProcessor::restoreAllContexts() {
 	if (contextStack->size() > 1) {
 		debug_log("restoreAllContexts: restoring all contexts\n\r");
 		context = contextStack->front();
-		contextStack->clear();
-		contextStack->push_back(context);
+		while (contextStack->size() > 1) {
+			recycleContext(std::move(contextStack->back()));
+			contextStack->pop_back();
+		}
 		context->activate();
 	} else {
 		debug_log("restoreAllContexts: no contexts to restore\n\r");
@@ -176,6 +182,27 @@ void VDUStreamProcessor::clearContextStack() {
 	contextStack->push_back(context);
 }
 
+// Copy a context, reusing a spare one if there is one, so saves don't need a PSRAM allocation
+//
+std::shared_ptr<Context> VDUStreamProcessor::copyContext(const Context &c) {
+	if (spareContexts.empty()) {
+		return make_shared_psram<Context>(c);
+	}
+	auto newContext = std::move(spareContexts.back());
+	spareContexts.pop_back();
+	*newContext = c;
+	return newContext;
+}
+
+// Keep a popped context to reuse, unless something else still holds it
+//
+void VDUStreamProcessor::recycleContext(std::shared_ptr<Context> c) {
+	if (c && c.use_count() == 1 && spareContexts.size() < MAX_SPARE_CONTEXTS) {
+		c->releaseShared();
+		spareContexts.push_back(std::move(c));
+	}
+}
+
 // Context reset, performed when changing screen modes
 //
 void VDUStreamProcessor::resetAllContexts() {
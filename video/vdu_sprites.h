@@ -4,7 +4,10 @@
 #include <fabgl.h>
 #include <cmath>
 
+#include "bitmap_blit.h"
 #include "buffers.h"
+#include "canvas_state.h"
+#include "sprite_collisions.h"
 #include "sprites.h"
 #include "types.h"
 #include "vdu_stream_processor.h"
@@ -185,6 +188,63 @@ void VDUStreamProcessor::vdu_sys_sprites() {
 			}
 		}	break;
 
+		case 0x22: {	// Create atlas of bitmaps from a grid of cells in a sheet buffer
+			auto sheetId = readWord_t(); if (sheetId == -1) return;
+			auto format = readByte_t(); if (format == -1) return;
+			auto sheetWidth = readWord_t(); if (sheetWidth == -1) return;
+			auto cellWidth = readWord_t(); if (cellWidth == -1) return;
+			auto cellHeight = readWord_t(); if (cellHeight == -1) return;
+			auto firstBitmapId = readWord_t(); if (firstBitmapId == -1) return;
+			auto sheetIter = buffers.find(sheetId);
+			if (sheetIter == buffers.end() || sheetIter->second.size() != 1 || cellWidth == 0 || cellHeight == 0 || sheetWidth < cellWidth) {
+				debug_log("vdu_sys_sprites: buffer %d not found, not a singular buffer, or bad cell size\n\r", sheetId);
+				return;
+			}
+			// sheet height is worked out from the buffer size
+			auto rowBytes = format == 2 ? (sheetWidth + 7) / 8 : format == 1 || format == 3 ? sheetWidth : sheetWidth * 4;
+			auto sheetHeight = sheetIter->second[0]->size() / rowBytes;
+			std::vector<Rect> rects;
+			for (auto y = 0; y + cellHeight <= sheetHeight; y += cellHeight) {
+				for (auto x = 0; x + cellWidth <= sheetWidth; x += cellWidth) {
+					rects.push_back(Rect(x, y, x + cellWidth - 1, y + cellHeight - 1));
+				}
+			}
+			createBitmapAtlas(sheetId, format, sheetWidth, rects, firstBitmapId);
+		}	break;
+
+		case 0x23: {	// Create atlas of bitmaps from a list of rectangles in a sheet buffer
+			auto sheetId = readWord_t(); if (sheetId == -1) return;
+			auto format = readByte_t(); if (format == -1) return;
+			auto sheetWidth = readWord_t(); if (sheetWidth == -1) return;
+			auto rectsId = readWord_t(); if (rectsId == -1) return;
+			auto firstBitmapId = readWord_t(); if (firstBitmapId == -1) return;
+			if (buffers.find(rectsId) == buffers.end()) {
+				debug_log("vdu_sys_sprites: buffer %d not found\n\r", rectsId);
+				return;
+			}
+			auto rectsBuffer = consolidateBuffers(buffers[rectsId]);
+			if (!rectsBuffer) {
+				debug_log("vdu_sys_sprites: failed to consolidate buffer %d\n\r", rectsId);
+				return;
+			}
+			// each rectangle is x; y; width; height;
+			auto data = rectsBuffer->getBuffer();
+			std::vector<Rect> rects;
+			for (uint32_t offset = 0; offset + 8 <= rectsBuffer->size(); offset += 8) {
+				int x = data[offset] | (data[offset + 1] << 8);
+				int y = data[offset + 2] | (data[offset + 3] << 8);
+				int width = data[offset + 4] | (data[offset + 5] << 8);
+				int height = data[offset + 6] | (data[offset + 7] << 8);
+				rects.push_back(Rect(x, y, x + width - 1, y + height - 1));
+			}
+			createBitmapAtlas(sheetId, format, sheetWidth, rects, firstBitmapId);
+		}	break;
+
+		case 0x24: {	// Capture bitmap from the screen in the native format of the current mode
+			auto bufferId = readWord_t(); if (bufferId == -1) return;
+			createBitmapFromScreen(bufferId, true);
+		}	break;
+
 		case 0x26: {	// add sprite frame for bitmap (long ID)
 			auto bufferId = readWord_t(); if (bufferId == -1) return;
 			addSpriteFrame(bufferId);
@@ -201,6 +261,71 @@ void VDUStreamProcessor::vdu_sys_sprites() {
 			}
 		}	break;
 
+		case 0x50: {	// Update sprites from a buffer of records, then refresh
+			auto bufferId = readWord_t(); if (bufferId == -1) return;
+			if (buffers.find(bufferId) == buffers.end()) {
+				debug_log("vdu_sys_sprites: buffer %d not found\n\r", bufferId);
+				return;
+			}
+			auto buffer = consolidateBuffers(buffers[bufferId]);
+			if (!buffer) {
+				debug_log("vdu_sys_sprites: failed to consolidate buffer %d\n\r", bufferId);
+				return;
+			}
+			updateSprites(buffer->getBuffer(), buffer->size());
+			refreshSprites();
+			debug_log("vdu_sys_sprites: updated %d sprites from buffer %d\n\r", buffer->size() / SPRITE_UPDATE_RECORD_SIZE, bufferId);
+		}	break;
+
+		case 0x51: {	// Find sprite collisions, writing pairs to a buffer
+			auto bufferId = readWord_t(); if (bufferId == -1) return;
+			auto flags = readByte_t(); if (flags == -1) return;
+			std::vector<uint8_t> pairs;
+			findSpriteCollisions(flags & SPRITE_COLLISION_PIXELS, pairs);
+			// buffer holds a 16-bit pair count, followed by pairs of sprite IDs
+			bufferClear(bufferId);
+			auto buffer = bufferCreate(bufferId, pairs.size() + 2);
+			if (!buffer) {
+				debug_log("vdu_sys_sprites: failed to create collision buffer %d\n\r", bufferId);
+				return;
+			}
+			auto data = buffer->getBuffer();
+			auto count = pairs.size() / 2;
+			data[0] = count & 0xFF;
+			data[1] = (count >> 8) & 0xFF;
+			if (count) {
+				memcpy(data + 2, pairs.data(), pairs.size());
+			}
+			debug_log("vdu_sys_sprites: %d sprite collisions written to buffer %d\n\r", count, bufferId);
+		}	break;
+
+		// Tile map layer
+		case 0x60: {	// Set tile map buffer, size in tiles
+			auto bufferId = readWord_t(); if (bufferId == -1) return;
+			auto width = readWord_t(); if (width == -1) return;
+			auto height = readWord_t(); if (height == -1) return;
+			tileMap.setMap(bufferId, width, height);
+			debug_log("vdu_sys_sprites: tile map set to buffer %d, (%dx%d)\n\r", bufferId, width, height);
+		}	break;
+
+		case 0x61: {	// Set tileset buffer of bitmap IDs, tile size in pixels
+			auto bufferId = readWord_t(); if (bufferId == -1) return;
+			auto width = readWord_t(); if (width == -1) return;
+			auto height = readWord_t(); if (height == -1) return;
+			tileMap.setTileset(bufferId, width, height);
+			debug_log("vdu_sys_sprites: tileset set to buffer %d, tiles (%dx%d)\n\r", bufferId, width, height);
+		}	break;
+
+		case 0x62: {	// Scroll tile map to pixel offset
+			auto x = readWord_t(); if (x == -1) return;
+			auto y = readWord_t(); if (y == -1) return;
+			context->scrollTileMapTo((int16_t)x, (int16_t)y);
+		}	break;
+
+		case 0x63: {	// Draw whole tile map
+			context->drawTileMap();
+		}	break;
+
 		default: {
 			debug_log("vdu_sys_sprites: unknown command %d\n\r", cmd);
 		}	break;
@@ -219,15 +344,21 @@ void VDUStreamProcessor::receiveBitmap(uint16_t bufferId, uint16_t width, uint16
 	createBitmapFromBuffer(bufferId, 0, width, height);
 }
 
-void VDUStreamProcessor::createBitmapFromScreen(uint16_t bufferId) {
+// Capture the screen area between the last two graphics cursor positions into a bitmap
+// Native captures are only valid in the current mode and palette, but are a straight copy of the framebuffer,
+// so are quick to take and to draw back.  They fall back to RGBA2222 when sprites or the mouse cursor are
+// composited over the framebuffer
+//
+void VDUStreamProcessor::createBitmapFromScreen(uint16_t bufferId, bool native) {
 	bufferClear(bufferId);
 	// get screen rectangle from last two graphics cursor positions
 	auto rect = context->getGraphicsRect();
-	auto size = rect.width() * rect.height();
-	if (size == 0) {
+	// a rect that misses the viewport can have two negative dimensions, so check each one
+	if (rect.width() <= 0 || rect.height() <= 0) {
 		debug_log("vdu_sys_sprites: bitmap %d - zero size\n\r", bufferId);
 		return;
 	}
+	auto size = rect.width() * rect.height();
 
 	// create a new buffer of appropriate size, and set as a native format bitmap
 	auto buffer = bufferCreate(bufferId, size);
@@ -235,9 +366,26 @@ void VDUStreamProcessor::createBitmapFromScreen(uint16_t bufferId) {
 		debug_log("vdu_sys_sprites: failed to create buffer\n\r");
 		return;
 	}
+	// batched spans must reach the screen before it is read
+	canvasState.flush();
+	if (native && !hasActiveSprites() && !mouseEnabled) {
+		createBitmapFromBuffer(bufferId, 3, rect.width(), rect.height());
+		auto bitmap = getBitmap(bufferId);
+		if (!bitmap) {
+			debug_log("vdu_sys_sprites: bitmap %d - couldn't create native bitmap\n\r", bufferId);
+			return;
+		}
+		captureNativeBitmap(bufferId, bitmap, rect.X1, rect.Y1);
+		return;
+	}
 	createBitmapFromBuffer(bufferId, 1, rect.width(), rect.height());
+	auto bitmap = getBitmap(bufferId);
+	if (!bitmap) {
+		debug_log("vdu_sys_sprites: bitmap %d - couldn't create bitmap\n\r", bufferId);
+		return;
+	}
 	// Copy screen area to buffer
-	canvas->copyToBitmap(rect.X1, rect.Y1, getBitmap(bufferId).get());
+	canvas->copyToBitmap(rect.X1, rect.Y1, bitmap.get());
 }
 
 void VDUStreamProcessor::createEmptyBitmap(uint16_t bufferId, uint16_t width, uint16_t height, uint32_t color) {
@@ -307,6 +455,27 @@ void VDUStreamProcessor::createBitmapFromBuffer(uint16_t bufferId, uint8_t forma
 		return;
 	}
 	auto data = stream->getBuffer();
+	if (format == 0 && isTestFlagSet(TEST_FLAG_NATIVE_BITMAPS)) {
+		// draw opaque bitmaps from a native copy, and others from an RGBA2222 copy
+		// both copies belong to the bitmap, so the buffer is left as the caller wrote it
+		if (isOpaqueRGBA8888(data, width * height)) {
+			auto bitmap = createNativeBitmap(bufferId, stream, width, height);
+			if (bitmap) {
+				bitmaps[bufferId] = bitmap;
+				debug_log("vdu_sys_sprites: bitmap created for bufferId %d, native, (%dx%d)\n\r", bufferId, width, height);
+				return;
+			}
+		}
+		auto compact = make_shared_psram<WritableBufferStream>(width * height);
+		if (compact && compact->getBuffer()) {
+			packRGBA2222(data, compact->getBuffer(), width * height);
+			bitmapBackings[bufferId] = compact;
+			bitmaps[bufferId] = make_shared_psram<Bitmap>(width, height, compact->getBuffer(), PixelFormat::RGBA2222);
+			debug_log("vdu_sys_sprites: bitmap created for bufferId %d, RGBA2222, (%dx%d)\n\r", bufferId, width, height);
+			return;
+		}
+		debug_log("vdu_sys_sprites: buffer %d - couldn't allocate compact copy, keeping RGBA8888\n\r", bufferId);
+	}
 	if (bytesPerPixel < 1) {
 		// get our current foreground graphics colour
 		RGB888 colour;
@@ -318,4 +487,98 @@ void VDUStreamProcessor::createBitmapFromBuffer(uint16_t bufferId, uint8_t forma
 	debug_log("vdu_sys_sprites: bitmap created for bufferId %d, format %d, (%dx%d)\n\r", bufferId, format, width, height);
 }
 
+// Create bitmaps for rectangles of a sheet buffer, with consecutive IDs starting from firstBitmapId
+// All the bitmaps share a single allocation.  If every rectangle spans the full width of the sheet,
+// the bitmaps reference the sheet's own pixels, otherwise the rectangles are packed into one new block.
+// Bitmaps hold a reference to their shared storage, so clearing the sheet buffer leaves them intact
+//
+void VDUStreamProcessor::createBitmapAtlas(uint16_t sheetId, uint8_t format, uint16_t sheetWidth, const std::vector<Rect> &rects, uint16_t firstBitmapId) {
+	if (buffers.find(sheetId) == buffers.end() || buffers[sheetId].size() != 1) {
+		debug_log("vdu_sys_sprites: buffer %d not found, or not a singular buffer\n\r", sheetId);
+		return;
+	}
+	if (sheetWidth == 0 || rects.empty() || firstBitmapId + rects.size() > 65535) {
+		debug_log("vdu_sys_sprites: atlas for buffer %d has %d rectangles, starting at bitmap %d\n\r", sheetId, rects.size(), firstBitmapId);
+		return;
+	}
+	PixelFormat pixelFormat;
+	uint32_t bytesPerPixel = 1;
+	switch (format) {
+		case 0:	// RGBA8888
+			pixelFormat = PixelFormat::RGBA8888;
+			bytesPerPixel = 4;
+			break;
+		case 1:	// RGBA2222
+			pixelFormat = PixelFormat::RGBA2222;
+			break;
+		case 2: // Mono/Mask
+			pixelFormat = PixelFormat::Mask;
+			break;
+		case 3: // Native
+			pixelFormat = PixelFormat::Native;
+			break;
+		default:
+			debug_log("vdu_sys_sprites: buffer %d - unknown pixel format %d for atlas\n\r", sheetId, format);
+			return;
+	}
+	auto sheet = buffers[sheetId][0];
+	auto sheetRowBytes = format == 2 ? (sheetWidth + 7) / 8 : sheetWidth * bytesPerPixel;
+	int sheetHeight = sheet->size() / sheetRowBytes;
+
+	// check the rectangles, and whether they are all full width bands of the sheet
+	bool bands = true;
+	uint32_t packedSize = 0;
+	for (auto &rect : rects) {
+		if (rect.X1 < 0 || rect.Y1 < 0 || rect.X2 < rect.X1 || rect.Y2 < rect.Y1 || rect.X2 >= sheetWidth || rect.Y2 >= sheetHeight) {
+			debug_log("vdu_sys_sprites: atlas rectangle (%d,%d)-(%d,%d) is outside buffer %d\n\r", rect.X1, rect.Y1, rect.X2, rect.Y2, sheetId);
+			return;
+		}
+		bands = bands && rect.X1 == 0 && rect.X2 == sheetWidth - 1;
+		packedSize += rect.width() * rect.height() * bytesPerPixel;
+	}
+	if (!bands && format == 2) {
+		// mask rows are bit packed, so can't be cut at arbitrary columns
+		debug_log("vdu_sys_sprites: atlas rectangles for mask buffer %d must be full width\n\r", sheetId);
+		return;
+	}
+
+	std::shared_ptr<BufferStream> backing = sheet;
+	if (!bands) {
+		backing = make_shared_psram<BufferStream>(packedSize);
+		if (!backing || !backing->getBuffer()) {
+			debug_log("vdu_sys_sprites: failed to allocate %d bytes for atlas of buffer %d\n\r", packedSize, sheetId);
+			return;
+		}
+	}
+
+	RGB888 colour;
+	context->getColour(130, &colour);
+	uint32_t offset = 0;
+	for (size_t i = 0; i < rects.size(); i++) {
+		auto &rect = rects[i];
+		uint16_t bitmapId = firstBitmapId + i;
+		clearBitmap(bitmapId);
+		// TODO unmap bitmap from characters for all contexts
+		context->unmapBitmapFromChars(bitmapId);
+		uint8_t * data;
+		if (bands) {
+			data = sheet->getBuffer() + rect.Y1 * sheetRowBytes;
+		} else {
+			data = backing->getBuffer() + offset;
+			auto rowBytes = rect.width() * bytesPerPixel;
+			for (auto y = rect.Y1; y <= rect.Y2; y++) {
+				memcpy(data + (y - rect.Y1) * rowBytes, sheet->getBuffer() + y * sheetRowBytes + rect.X1 * bytesPerPixel, rowBytes);
+			}
+			offset += rowBytes * rect.height();
+		}
+		if (format == 2) {
+			bitmaps[bitmapId] = make_shared_psram<Bitmap>(rect.width(), rect.height(), data, pixelFormat, colour);
+		} else {
+			bitmaps[bitmapId] = make_shared_psram<Bitmap>(rect.width(), rect.height(), data, pixelFormat);
+		}
+		bitmapBackings[bitmapId] = backing;
+	}
+	debug_log("vdu_sys_sprites: %d atlas bitmaps created from buffer %d, starting at bitmap %d (%s)\n\r", rects.size(), sheetId, firstBitmapId, bands ? "shared" : "packed");
+}
+
 #endif // _VDU_SPRITES_H_
@@ -30,6 +30,7 @@ class VDUStreamProcessor {
 		// Graphics context storage and management
 		std::shared_ptr<Context> context;					// Current active context
 		std::shared_ptr<std::vector<std::shared_ptr<Context>>> contextStack;	// Current active context stack
+		std::vector<std::shared_ptr<Context>> spareContexts;	// Popped contexts kept for reuse by saves
 
 		bool commandsEnabled = true;
 
@@ -74,12 +75,13 @@ class VDUStreamProcessor {
 		void vdu_sys_audio();
 		void sendAudioStatus(uint8_t channel, uint8_t status);
 		uint8_t loadSample(uint16_t bufferId, uint32_t length);
-		uint8_t createSampleFromBuffer(uint16_t bufferId, uint8_t format, uint16_t sampleRate);
+		uint8_t createSampleFromBuffer(uint16_t bufferId, uint8_t format, uint16_t sampleRate, bool stream = false);
 		uint8_t setVolumeEnvelope(uint8_t channel, uint8_t type);
 		uint8_t setFrequencyEnvelope(uint8_t channel, uint8_t type);
 		uint8_t setSampleFrequency(uint16_t bufferId, uint16_t frequency);
 		uint8_t setSampleRepeatStart(uint16_t bufferId, uint32_t offset);
 		uint8_t setSampleRepeatLength(uint16_t bufferId, uint32_t length);
+		uint8_t loadSequence(uint8_t channel, uint16_t bufferId);
 		uint8_t setParameter(uint8_t channel, uint8_t parameter, uint16_t value);
 
 		void vdu_sys_font();
@@ -93,12 +95,15 @@ class VDUStreamProcessor {
 		void restoreAllContexts();
 		void clearContextStack();
 		void resetAllContexts();
+		std::shared_ptr<Context> copyContext(const Context &c);
+		void recycleContext(std::shared_ptr<Context> c);
 
 		void vdu_sys_sprites();
 		void receiveBitmap(uint16_t bufferId, uint16_t width, uint16_t height);
-		void createBitmapFromScreen(uint16_t bufferId);
+		void createBitmapFromScreen(uint16_t bufferId, bool native = false);
 		void createEmptyBitmap(uint16_t bufferId, uint16_t width, uint16_t height, uint32_t color);
 		void createBitmapFromBuffer(uint16_t bufferId, uint8_t format, uint16_t width, uint16_t height);
+		void createBitmapAtlas(uint16_t sheetId, uint8_t format, uint16_t sheetWidth, const std::vector<Rect> &rects, uint16_t firstBitmapId);
 
 		void vdu_sys_hexload(void);
 		void sendKeycodeByte(uint8_t b, bool waitack);
@@ -364,6 +364,8 @@ bool processTerminal() {
 		} break;
 		case TerminalState::Suspending: {
 			// No need to deactivate terminal here... we just stop sending it serial data
+			// but the terminal will have changed the canvas drawing state
+			canvasState.invalidate();
 			debug_log("Terminal suspended\n\r");
 			terminalState = TerminalState::Suspended;
 		} break;
@@ -0,0 +1,193 @@
+#ifndef WAVEFORM_GENERATORS_H
+#define WAVEFORM_GENERATORS_H
+
+// Block rendering waveform generators
+// fabgl's generators produce one sample per virtual getSample() call.  These generators instead
+// fill a block of samples in one call, reading their volume and frequency once per block, so the
+// mixer only makes one virtual call per channel per block.
+//
+// Tone generators use a 32-bit phase accumulator, with the top 8 bits indexing one cycle
+//
+
+#include <cmath>
+#include <string.h>
+#include <fabgl.h>
+
+#include "types.h"
+
+class BlockWaveformGenerator : public WaveformGenerator {
+	public:
+		// Fill buffer with count samples, with volume applied
+		virtual void renderBlock(int16_t * buffer, int count) = 0;
+
+		int getSample() {
+			int16_t sample;
+			renderBlock(&sample, 1);
+			return sample;
+		}
+
+	protected:
+		static inline int applyVolume(int sample, int volume) {
+			return sample * volume / 127;
+		}
+};
+
+// Base for tone generators, which step a phase accumulator through one cycle per period
+// The derived class provides waveform(index), giving the sample value (-128 to 127) at a point
+// in the cycle (0 to 255), which is inlined into the render loop
+//
+template <typename Derived>
+class PhaseWaveformGenerator : public BlockWaveformGenerator {
+	public:
+		void setFrequency(int value) {
+			frequency = value;
+			updatePhaseStep();
+		}
+
+		void setSampleRate(int value) {
+			WaveformGenerator::setSampleRate(value);
+			updatePhaseStep();
+		}
+
+		void renderBlock(int16_t * buffer, int count) {
+			if (frequency == 0 || duration() == 0) {
+				// fade out towards silence, rather than stopping with a click
+				for (int i = 0; i < count; i++) {
+					lastSample -= (lastSample > 0) - (lastSample < 0);
+					buffer[i] = lastSample;
+				}
+				phase = 0;
+				return;
+			}
+			auto volume = this->volume();
+			auto derived = static_cast<Derived *>(this);
+			for (int i = 0; i < count; i++) {
+				buffer[i] = applyVolume(derived->waveform(phase >> 24), volume);
+				phase += phaseStep;
+			}
+			lastSample = buffer[count - 1];
+		}
+
+	private:
+		void updatePhaseStep() {
+			phaseStep = sampleRate() ? (uint32_t)(((uint64_t)frequency << 32) / sampleRate()) : 0;
+		}
+
+		int			frequency = 0;
+		uint32_t	phase = 0;
+		uint32_t	phaseStep = 0;
+		int16_t		lastSample = 0;
+};
+
+class SineBlockGenerator : public PhaseWaveformGenerator<SineBlockGenerator> {
+	public:
+		SineBlockGenerator() : table(getSineTable()) {}
+
+		inline int waveform(uint8_t index) {
+			return table[index];
+		}
+
+	private:
+		const int8_t * table;
+
+		static const int8_t * getSineTable() {
+			static int8_t sineTable[256];
+			static bool built = false;
+			if (!built) {
+				for (int i = 0; i < 256; i++) {
+					sineTable[i] = (int8_t)lroundf(sinf(i * (float)M_PI / 128.0f) * 127.0f);
+				}
+				built = true;
+			}
+			return sineTable;
+		}
+};
+
+class SquareBlockGenerator : public PhaseWaveformGenerator<SquareBlockGenerator> {
+	public:
+		// Duty cycle is the point in the cycle (0 to 255) where the wave goes low
+		void setDutyCycle(int value) {
+			dutyCycle = value;
+		}
+
+		inline int waveform(uint8_t index) {
+			return index <= dutyCycle ? 127 : -127;
+		}
+
+	private:
+		uint8_t		dutyCycle = 127;
+};
+
+class TriangleBlockGenerator : public PhaseWaveformGenerator<TriangleBlockGenerator> {
+	public:
+		inline int waveform(uint8_t index) {
+			return index < 128 ? index * 2 - 127 : 383 - index * 2;
+		}
+};
+
+class SawtoothBlockGenerator : public PhaseWaveformGenerator<SawtoothBlockGenerator> {
+	public:
+		inline int waveform(uint8_t index) {
+			return index - 128;
+		}
+};
+
+// Wavetable generator, playing a single cycle of 256 8-bit signed values
+// A second table can be given to morph towards, in which case the two tables are blended into the
+// table that plays whenever the morph changes, so playback costs the same as a single table
+//
+#define WAVETABLE_SIZE	256
+
+class WavetableBlockGenerator : public PhaseWaveformGenerator<WavetableBlockGenerator> {
+	public:
+		// data holds WAVETABLE_SIZE values, or twice that to morph between two tables
+		WavetableBlockGenerator(const int8_t * data, bool morphs) : morphs(morphs) {
+			memcpy(tables[0], data, WAVETABLE_SIZE);
+			memcpy(tables[1], morphs ? data + WAVETABLE_SIZE : data, WAVETABLE_SIZE);
+			memcpy(table, tables[0], WAVETABLE_SIZE);
+		}
+
+		void setMorph(uint8_t value) {
+			if (!morphs) {
+				return;
+			}
+			for (int i = 0; i < WAVETABLE_SIZE; i++) {
+				table[i] = (tables[0][i] * (255 - value) + tables[1][i] * value) / 255;
+			}
+		}
+
+		inline int waveform(uint8_t index) {
+			return table[index];
+		}
+
+	private:
+		int8_t		table[WAVETABLE_SIZE];		// Table being played
+		int8_t		tables[2][WAVETABLE_SIZE];	// Tables to morph between
+		bool		morphs;
+};
+
+// White noise from a 16-bit Galois LFSR, which ignores frequency
+//
+class NoiseBlockGenerator : public BlockWaveformGenerator {
+	public:
+		void setFrequency(int value) {}
+
+		void renderBlock(int16_t * buffer, int count) {
+			if (duration() == 0) {
+				for (int i = 0; i < count; i++) {
+					buffer[i] = 0;
+				}
+				return;
+			}
+			auto volume = this->volume();
+			for (int i = 0; i < count; i++) {
+				noise = (noise >> 1) ^ (-(noise & 1u) & 0xB400u);
+				buffer[i] = applyVolume(127 - (noise >> 8), volume);
+			}
+		}
+
+	private:
+		uint16_t	noise = 0xFAB7;
+};
+
+#endif // WAVEFORM_GENERATORS_H